@@ -1,7 +1,34 @@
+# Extra flags through the environment, e.g. ZSEB_FLAGS=-DZSEB_STATS sh compile.sh for --stats
 #g++ -g -pthread -Wall\
 #icpc -flto -xHost -qopenmp -ipo -O3 -Wall\
-g++ -O3 -pthread -march=native -flto -funroll-loops -Wall\
+g++ -O3 -pthread -march=native -flto -funroll-loops -Wall $ZSEB_FLAGS\
     src/main.cpp\
     src/zseb.cpp\
+    src/compressor.cpp\
+    src/decompressor.cpp\
+    src/speculate.cpp\
+    src/dictionary.cpp\
     src/huffman.cpp -o zseb
 
+g++ -O3 -pthread -march=native -flto -funroll-loops -Wall $ZSEB_FLAGS\
+    src/bench.cpp\
+    src/zseb.cpp\
+    src/compressor.cpp\
+    src/decompressor.cpp\
+    src/speculate.cpp\
+    src/dictionary.cpp\
+    src/huffman.cpp -o zseb-bench
+
+g++ -O3 -march=native -flto -funroll-loops -Wall $ZSEB_FLAGS\
+    src/microbench.cpp\
+    src/huffman.cpp -o zseb-micro
+
+# Needs the system zlib; for libFuzzer: clang++ -DZSEB_LIBFUZZER -fsanitize=fuzzer,address with the same sources
+g++ -O2 -g -pthread -march=native -Wall $ZSEB_FLAGS\
+    src/fuzz.cpp\
+    src/zseb.cpp\
+    src/compressor.cpp\
+    src/decompressor.cpp\
+    src/speculate.cpp\
+    src/dictionary.cpp\
+    src/huffman.cpp -lz -o zseb-fuzz
@@ -0,0 +1,156 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <limits.h>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+namespace zseb
+{
+namespace adler32
+{
+
+
+constexpr const uint32_t BASE = 65521; // Largest prime smaller than 65536
+constexpr const uint32_t NMAX = 5552;  // Largest n such that 255 n (n + 1) / 2 + (n + 1) (BASE - 1) <= 2^32 - 1
+
+
+inline uint32_t update_scalar(uint32_t s1, uint32_t s2, const uint8_t * data, uint32_t length) noexcept
+{
+    while (length != 0)
+    {
+        const uint32_t todo = length < NMAX ? length : NMAX;
+        for (uint32_t index = 0; index < todo; ++index)
+        {
+            s1 += data[index];
+            s2 += s1;
+        }
+        s1 %= BASE;
+        s2 %= BASE;
+        data   += todo;
+        length -= todo;
+    }
+    return (s2 << 16) | s1;
+}
+
+
+#if defined(__AVX2__)
+
+constexpr const uint32_t VECTOR = 32;
+
+inline uint32_t hsum(const __m256i vec) noexcept
+{
+    const __m128i half = _mm_add_epi32(_mm256_castsi256_si128(vec), _mm256_extracti128_si256(vec, 1));
+    const __m128i quad = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_add_epi32(quad, _mm_shuffle_epi32(quad, _MM_SHUFFLE(2, 3, 0, 1)))));
+}
+
+// Per VECTOR bytes: s2 += VECTOR * s1 + sum (VECTOR - i) data[i] and s1 += sum data[i]
+inline uint32_t update_vector(uint32_t& s1, uint32_t& s2, const uint8_t * data, const uint32_t blocks) noexcept
+{
+    const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                             16, 15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i vs1 = zero; // Sum of bytes
+    __m256i vps = zero; // Sum of vs1 prior to each block
+    __m256i vs2 = zero; // Weighted sum of bytes
+
+    for (uint32_t block = 0; block < blocks; ++block)
+    {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + block * VECTOR));
+        vps = _mm256_add_epi32(vps, vs1);
+        vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(bytes, zero));
+        vs2 = _mm256_add_epi32(vs2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+    }
+
+    const uint64_t work2 = s2 + static_cast<uint64_t>(s1) * VECTOR * blocks + static_cast<uint64_t>(hsum(vps)) * VECTOR + hsum(vs2);
+    s1 = (s1 + hsum(vs1)) % BASE;
+    s2 = static_cast<uint32_t>(work2 % BASE);
+    return blocks * VECTOR;
+}
+
+#elif defined(__SSSE3__)
+
+constexpr const uint32_t VECTOR = 16;
+
+inline uint32_t hsum(const __m128i vec) noexcept
+{
+    const __m128i half = _mm_add_epi32(vec,  _mm_shuffle_epi32(vec,  _MM_SHUFFLE(1, 0, 3, 2)));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)))));
+}
+
+// Per VECTOR bytes: s2 += VECTOR * s1 + sum (VECTOR - i) data[i] and s1 += sum data[i]
+inline uint32_t update_vector(uint32_t& s1, uint32_t& s2, const uint8_t * data, const uint32_t blocks) noexcept
+{
+    const __m128i weights = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i vs1 = zero; // Sum of bytes
+    __m128i vps = zero; // Sum of vs1 prior to each block
+    __m128i vs2 = zero; // Weighted sum of bytes
+
+    for (uint32_t block = 0; block < blocks; ++block)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + block * VECTOR));
+        vps = _mm_add_epi32(vps, vs1);
+        vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(bytes, zero));
+        vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_maddubs_epi16(bytes, weights), ones));
+    }
+
+    const uint64_t work2 = s2 + static_cast<uint64_t>(s1) * VECTOR * blocks + static_cast<uint64_t>(hsum(vps)) * VECTOR + hsum(vs2);
+    s1 = (s1 + hsum(vs1)) % BASE;
+    s2 = static_cast<uint32_t>(work2 % BASE);
+    return blocks * VECTOR;
+}
+
+#endif
+
+
+inline uint32_t update(const uint32_t adler, const char * data, uint32_t length) noexcept
+{
+    uint32_t s1 = adler & UINT16_MAX;
+    uint32_t s2 = adler >> 16;
+    const uint8_t * work = reinterpret_cast<const uint8_t *>(data);
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+    // Blocks of at most NMAX bytes, so that the vector lanes and the final reduction cannot overflow
+    while (length >= VECTOR)
+    {
+        const uint32_t todo = (length < NMAX ? length : NMAX) / VECTOR;
+        const uint32_t done = update_vector(s1, s2, work, todo);
+        work   += done;
+        length -= done;
+    }
+#endif
+
+    return update_scalar(s1, s2, work, length);
+}
+
+
+} // End of namespace adler32
+} // End of namespace zseb
+
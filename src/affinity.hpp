@@ -0,0 +1,221 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Placement of the LZ77 workers of zip (zseb -a). When enabled, worker t pins itself to the t-th allowed CPU (round
+// robin) before it allocates and clears its hash chains, so that these pages are first touched on its own NUMA node.
+// The frame, which all workers read, is interleaved over the NUMA nodes with memory instead.
+
+namespace zseb
+{
+namespace affinity
+{
+
+
+struct settings
+{
+    bool pinned;
+    std::vector<int> cpus; // Allowed CPUs at the time of enable()
+};
+
+inline settings& global()
+{
+    static settings item{ false, {} };
+    return item;
+}
+
+inline std::vector<int> allowed()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu){ if (CPU_ISSET(cpu, &set)){ cpus.push_back(cpu); } }
+    }
+    return cpus;
+}
+
+inline void enable()
+{
+    global().pinned = true;
+    global().cpus   = allowed();
+}
+
+// Pin the calling thread for worker ID; no-op unless enabled
+inline void pin(const uint32_t worker)
+{
+    const settings& item = global();
+    if ((!item.pinned) || item.cpus.empty())
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(item.cpus[worker % item.cpus.size()], &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+// Restores the affinity mask of the calling thread on destruction, for a worker which runs on the caller's own thread
+class keep
+{
+    public:
+
+        keep() : saved(global().pinned && (sched_getaffinity(0, sizeof(set), &set) == 0)) {}
+
+        ~keep()
+        {
+            if (saved){ sched_setaffinity(0, sizeof(set), &set); }
+        }
+
+        keep(const keep&) = delete;
+        keep& operator=(const keep&) = delete;
+
+    private:
+
+        cpu_set_t set;
+
+        const bool saved;
+};
+
+// CPUs granted by the cgroup CPU controller, from cpu.max (v2) or cpu.cfs_quota_us and cpu.cfs_period_us (v1) of the
+// cgroup of this process and its ancestors; 0 if unlimited or unknown
+inline double quota()
+{
+    double result = 0.0;
+    auto limit = [&result](const double quota, const double period)
+    {
+        if ((quota > 0.0) && (period > 0.0) && ((result == 0.0) || (quota / period < result)))
+            result = quota / period;
+    };
+
+    std::ifstream input("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(input, line))
+    {
+        // hierarchy-ID:controller-list:path, with an empty controller list for v2
+        const size_t first = line.find(':');
+        const size_t second = line.find(':', first + 1);
+        if ((first == std::string::npos) || (second == std::string::npos))
+            continue;
+        const std::string controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+        std::string path = line.substr(second + 1);
+        const bool v2 = controllers == ",,";
+        if ((!v2) && (controllers.find(",cpu,") == std::string::npos))
+            continue;
+
+        const std::vector<std::string> mounts = v2 ? std::vector<std::string>{ "/sys/fs/cgroup", "/sys/fs/cgroup/unified" }
+                                                   : std::vector<std::string>{ "/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct" };
+        for (const std::string& mount : mounts)
+        {
+            for (std::string dir = path; ; dir = dir.substr(0, dir.rfind('/')))
+            {
+                const std::string base = mount + (dir == "/" ? "" : dir);
+                if (v2)
+                {
+                    std::ifstream file(base + "/cpu.max");
+                    std::string max;
+                    double period = 0.0;
+                    if (file >> max >> period){ limit(max == "max" ? 0.0 : std::stod(max), period); }
+                }
+                else
+                {
+                    std::ifstream file_quota(base + "/cpu.cfs_quota_us");
+                    std::ifstream file_period(base + "/cpu.cfs_period_us");
+                    double quota = 0.0;
+                    double period = 0.0;
+                    if ((file_quota >> quota) && (file_period >> period)){ limit(quota, period); }
+                }
+                if (dir.empty() || (dir == "/"))
+                    break;
+            }
+        }
+    }
+    return result;
+}
+
+// Number of CPUs to use: the affinity mask, limited by the cgroup quota (rounded up); at least 1
+inline uint32_t available()
+{
+    uint32_t cpus = static_cast<uint32_t>(allowed().size());
+    const double share = quota();
+    if (share > 0.0)
+    {
+        const uint32_t granted = static_cast<uint32_t>(ceil(share));
+        if ((cpus == 0) || (granted < cpus))
+            cpus = granted;
+    }
+    return cpus == 0 ? 1 : cpus;
+}
+
+// Mask of the NUMA nodes with memory, from a sysfs list such as "0-1,3"; 0 if unknown
+inline unsigned long nodes()
+{
+    std::ifstream input("/sys/devices/system/node/has_memory");
+    std::string list;
+    if (!std::getline(input, list))
+        return 0;
+    unsigned long mask = 0;
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t next = 0;
+        const unsigned long first = std::stoul(list.substr(pos), &next);
+        unsigned long last = first;
+        pos += next;
+        if ((pos < list.size()) && (list[pos] == '-'))
+        {
+            last = std::stoul(list.substr(pos + 1), &next);
+            pos += next + 1;
+        }
+        for (unsigned long node = first; (node <= last) && (node < sizeof(mask) * CHAR_BIT); ++node){ mask |= 1UL << node; }
+        if ((pos < list.size()) && (list[pos] == ','))
+            ++pos;
+        else
+            break;
+    }
+    return mask;
+}
+
+// Interleave the pages of [data, data + size) over the NUMA nodes; data must be page aligned and not yet touched
+inline void interleave(void * data, const size_t size)
+{
+    if (!global().pinned)
+        return;
+    const unsigned long mask = nodes();
+    if ((mask & (mask - 1)) == 0) // At most one node
+        return;
+    syscall(SYS_mbind, data, size, MPOL_INTERLEAVE, &mask, sizeof(mask) * CHAR_BIT, 0);
+}
+
+
+} // End of namespace affinity
+} // End of namespace zseb
+
@@ -0,0 +1,486 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+// zseb-bench: reproducible compress / decompress throughput over a corpus and synthetic inputs
+
+#include <getopt.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dtypes.h"
+#include "zseb.h"
+#include "compressor.h"
+#include "decompressor.h"
+#include "pages.hpp"
+
+namespace
+{
+
+constexpr const uint32_t SYNTHETIC_SIZE = 1U << 22; // Bytes per synthetic input
+constexpr const uint32_t REPEAT_PERIOD  = 1U << 12; // Period of the long repeats input
+constexpr const uint32_t RANDOM_SEED    = 1;
+
+enum class operation { zip, unzip };
+
+struct result
+{
+    uint64_t size_orig;
+    uint64_t size_zip;
+    uint32_t repeats;
+    double   seconds[64]; // Per repeat
+    int64_t  dtlb_misses; // dTLB load misses of all repeats, over all threads; -1 without perf_event_open
+};
+
+struct row
+{
+    std::string input;
+    operation   modus;
+    uint32_t    threads;
+    bool        huge;     // Frame and hash chains of zip on huge pages (see pages.hpp)
+    result      stats;
+    long        peak_rss; // KiB
+};
+
+
+void print_help()
+{
+std::cout << "\n"
+"zseb-bench: throughput of zseb over a corpus and synthetic inputs\n"
+"\n"
+"Usage: zseb-bench [OPTIONS]\n"
+"\n"
+"    Every file of the corpus, and 4 MiB of zeros, random bytes and a 4 KiB\n"
+"    random pattern repeated, is zipped (raw DEFLATE, in memory) on each\n"
+"    thread count and unzipped again. Each configuration runs in a child\n"
+"    process, so that its peak RSS is its own. dTLB load misses per KiB\n"
+"    are reported when perf_event_open is permitted (empty otherwise).\n"
+"\n"
+"    ARGUMENTS\n"
+"        -c, --corpus=dir\n"
+"                Directory with the corpus files (default = calgary).\n"
+"\n"
+"        -t, --threads=list\n"
+"                Comma-separated zip thread counts (default = powers of\n"
+"                two up to hardware concurrency).\n"
+"\n"
+"        -P, --pages=list\n"
+"                Comma-separated page kinds of the zip frame and hash\n"
+"                chains: huge, small (default = huge,small).\n"
+"\n"
+"        -n, --repeats=num\n"
+"                Timed runs per configuration, at most 64 (default = 5).\n"
+"\n"
+"        -j, --json\n"
+"                Print JSON instead of CSV.\n"
+"\n"
+"        -o, --output=outfile\n"
+"                Output to outfile (default = stdout).\n"
+"\n"
+"        -h, --help\n"
+"                Display this help.\n"
+"\n"
+" " << std::endl;
+}
+
+
+std::vector<char> load_input(const std::string& name, const std::string& corpus)
+{
+    std::vector<char> data;
+    if (name == "synthetic:zeros")
+        data.assign(SYNTHETIC_SIZE, 0);
+    else if ((name == "synthetic:random") || (name == "synthetic:repeats"))
+    {
+        std::mt19937 generator(RANDOM_SEED);
+        data.resize(SYNTHETIC_SIZE);
+        const uint32_t period = (name == "synthetic:random") ? SYNTHETIC_SIZE : REPEAT_PERIOD;
+        for (uint32_t idx = 0; idx < period; ++idx){ data[idx] = static_cast<char>(generator() & UINT8_MAX); }
+        for (uint32_t idx = period; idx < SYNTHETIC_SIZE; ++idx){ data[idx] = data[idx - period]; }
+    }
+    else
+    {
+        std::ifstream file((corpus + "/" + name).c_str(), std::ios::in|std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    return data;
+}
+
+
+// Inflate the raw DEFLATE stream zipped into output, as tools::unzip would but without the disk
+void inflate(const std::vector<char>& zipped, std::vector<char>& output)
+{
+    zseb::stream::inbuf input(zipped.data(), zipped.size());
+    std::istream zipstream(&input);
+    zseb::ibstream zipfile(zipstream);
+    zseb::decompressor inflater;
+    inflater.reset();
+    output.clear();
+    while (!inflater.finished())
+    {
+        const char * data = nullptr;
+        const uint32_t size = inflater.next(zipfile, data);
+        output.insert(output.end(), data, data + size);
+    }
+    if (inflater.error() != zseb::inflate_error::none)
+    {
+        std::cerr << "zseb-bench: " << zseb::describe(inflater.error()) << std::endl;
+        exit(255);
+    }
+}
+
+
+// dTLB load misses of this process and the threads it starts from now on; -1 if not permitted
+class dtlb_counter
+{
+    public:
+
+        dtlb_counter()
+        {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size           = sizeof(attr);
+            attr.type           = PERF_TYPE_HW_CACHE;
+            attr.config         = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled       = 1;
+            attr.inherit        = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+            if (fd >= 0){ ioctl(fd, PERF_EVENT_IOC_ENABLE, 0); }
+        }
+
+        ~dtlb_counter(){ if (fd >= 0){ close(fd); } }
+
+        int64_t stop()
+        {
+            uint64_t value = 0;
+            if ((fd < 0) || (ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) != 0) || (read(fd, &value, sizeof(value)) != static_cast<ssize_t>(sizeof(value))))
+                return -1;
+            return static_cast<int64_t>(value);
+        }
+
+    private:
+
+        int fd;
+};
+
+
+// In the child: time repeats runs of modus; zip leaves its output in scratch for the unzip child
+result measure(const std::string& name, const std::string& corpus, const operation modus, const uint32_t threads, const bool huge, const uint32_t repeats, FILE * scratch)
+{
+    result stats;
+    memset(&stats, 0, sizeof(stats));
+    zseb::pages::global().huge = huge;
+    const std::vector<char> data = load_input(name, corpus);
+    stats.size_orig = data.size();
+    stats.repeats   = repeats;
+
+    std::vector<char> zipped;
+    if (modus == operation::zip)
+    {
+        zseb::compressor deflater(threads);
+        zipped.reserve(data.size() + data.size() / 8 + 1024);
+        dtlb_counter misses;
+        for (uint32_t run = 0; run < repeats; ++run)
+        {
+            zipped.clear();
+            auto start = std::chrono::steady_clock::now();
+            zseb::tools::zip(deflater, data.data(), data.size(), zipped, zseb::zseb_format::raw);
+            auto end = std::chrono::steady_clock::now();
+            stats.seconds[run] = std::chrono::duration<double>(end - start).count();
+        }
+        stats.dtlb_misses = misses.stop();
+        rewind(scratch);
+        if ((ftruncate(fileno(scratch), 0) != 0) || (fwrite(zipped.data(), 1, zipped.size(), scratch) != zipped.size()))
+        {
+            std::cerr << "zseb-bench: Unable to write the scratch file." << std::endl;
+            exit(255);
+        }
+        fflush(scratch);
+    }
+    else
+    {
+        fseek(scratch, 0, SEEK_END);
+        zipped.resize(ftell(scratch));
+        rewind(scratch);
+        if (fread(zipped.data(), 1, zipped.size(), scratch) != zipped.size())
+        {
+            std::cerr << "zseb-bench: Unable to read the scratch file." << std::endl;
+            exit(255);
+        }
+        std::vector<char> output;
+        output.reserve(data.size());
+        dtlb_counter misses;
+        for (uint32_t run = 0; run < repeats; ++run)
+        {
+            auto start = std::chrono::steady_clock::now();
+            inflate(zipped, output);
+            auto end = std::chrono::steady_clock::now();
+            stats.seconds[run] = std::chrono::duration<double>(end - start).count();
+        }
+        stats.dtlb_misses = misses.stop();
+        if (output != data)
+        {
+            std::cerr << "zseb-bench: Round trip of " << name << " failed." << std::endl;
+            exit(255);
+        }
+    }
+    stats.size_zip = zipped.size();
+    return stats;
+}
+
+
+// Fork, measure in the child and collect its result and peak RSS
+row run(const std::string& name, const std::string& corpus, const operation modus, const uint32_t threads, const bool huge, const uint32_t repeats, FILE * scratch)
+{
+    int channel[2];
+    if (pipe(channel) != 0)
+    {
+        std::cerr << "zseb-bench: Unable to create a pipe." << std::endl;
+        exit(255);
+    }
+
+    const pid_t child = fork();
+    if (child == 0)
+    {
+        close(channel[0]);
+        const result stats = measure(name, corpus, modus, threads, huge, repeats, scratch);
+        const bool sent = write(channel[1], &stats, sizeof(stats)) == static_cast<ssize_t>(sizeof(stats));
+        _exit(sent ? 0 : 255);
+    }
+
+    close(channel[1]);
+    row item = { name, modus, threads, huge, {}, 0 };
+    const bool received = read(channel[0], &item.stats, sizeof(item.stats)) == static_cast<ssize_t>(sizeof(item.stats));
+    close(channel[0]);
+    int status = 0;
+    struct rusage usage;
+    if ((child < 0) || (wait4(child, &status, 0, &usage) != child) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != 0) || (!received))
+    {
+        std::cerr << "zseb-bench: Benchmark of " << name << " failed." << std::endl;
+        exit(255);
+    }
+    item.peak_rss = usage.ru_maxrss;
+    return item;
+}
+
+
+// Nearest-rank percentile of the sorted values
+double percentile(const std::vector<double>& sorted, const double fraction)
+{
+    const size_t rank = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[rank];
+}
+
+
+void report(std::ostream& output, const std::vector<row>& rows, const bool json)
+{
+    if (json)
+        output << "[\n";
+    else
+        output << "input,bytes,operation,threads,pages,repeats,ratio,mbs_min,mbs_p50,mbs_p90,mbs_max,dtlb_misses_per_kib,peak_rss_kib\n";
+
+    for (size_t idx = 0; idx < rows.size(); ++idx)
+    {
+        const row& item = rows[idx];
+        std::vector<double> mbs; // Throughput over the uncompressed size, in MB/s
+        for (uint32_t run = 0; run < item.stats.repeats; ++run){ mbs.push_back(item.stats.size_orig / (1e6 * std::max(item.stats.seconds[run], 1e-9))); }
+        std::sort(mbs.begin(), mbs.end());
+        const double ratio = static_cast<double>(item.stats.size_orig) / std::max<uint64_t>(item.stats.size_zip, 1);
+        const char * modus = (item.modus == operation::zip) ? "zip" : "unzip";
+        const char * pages = (item.modus == operation::zip) ? (item.huge ? "huge" : "small") : "-";
+        std::stringstream dtlb; // Empty without perf_event_open
+        if (item.stats.dtlb_misses >= 0){ dtlb << item.stats.dtlb_misses / (item.stats.repeats * std::max(item.stats.size_orig / 1024.0, 1.0)); }
+
+        if (json)
+        {
+            output << "  {\"input\": \"" << item.input << "\", \"bytes\": " << item.stats.size_orig << ", \"operation\": \"" << modus << "\""
+                   << ", \"threads\": " << item.threads << ", \"pages\": \"" << pages << "\", \"repeats\": " << item.stats.repeats << ", \"ratio\": " << ratio
+                   << ", \"mbs\": {\"min\": " << mbs.front() << ", \"p50\": " << percentile(mbs, 0.5) << ", \"p90\": " << percentile(mbs, 0.9)
+                   << ", \"max\": " << mbs.back() << "}, \"dtlb_misses_per_kib\": " << (dtlb.str().empty() ? "null" : dtlb.str())
+                   << ", \"peak_rss_kib\": " << item.peak_rss << "}" << ((idx + 1 < rows.size()) ? ",\n" : "\n");
+        }
+        else
+        {
+            output << item.input << "," << item.stats.size_orig << "," << modus << "," << item.threads << "," << pages << "," << item.stats.repeats << "," << ratio
+                   << "," << mbs.front() << "," << percentile(mbs, 0.5) << "," << percentile(mbs, 0.9) << "," << mbs.back() << "," << dtlb.str() << "," << item.peak_rss << "\n";
+        }
+    }
+
+    if (json)
+        output << "]\n";
+}
+
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::string corpus = "calgary";
+    std::vector<uint32_t> thread_counts;
+    std::vector<bool> page_kinds;
+    uint32_t repeats = 5;
+    bool json = false;
+    std::string outfile;
+
+    struct option long_options[] =
+    {
+        {"corpus",  required_argument, 0, 'c'},
+        {"threads", required_argument, 0, 't'},
+        {"pages",   required_argument, 0, 'P'},
+        {"repeats", required_argument, 0, 'n'},
+        {"json",    no_argument,       0, 'j'},
+        {"output",  required_argument, 0, 'o'},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "hjc:t:P:n:o:", long_options, &option_index)) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+            case '?':
+                print_help();
+                return 0;
+            case 'c':
+                corpus = optarg;
+                break;
+            case 't':
+            {
+                std::stringstream list(optarg);
+                std::string item;
+                while (std::getline(list, item, ','))
+                {
+                    const int threads = atoi(item.c_str());
+                    if (threads <= 0)
+                    {
+                        std::cerr << "zseb-bench: option -t takes positive thread counts" << std::endl;
+                        return 255;
+                    }
+                    thread_counts.push_back(threads);
+                }
+                break;
+            }
+            case 'P':
+            {
+                std::stringstream list(optarg);
+                std::string item;
+                while (std::getline(list, item, ','))
+                {
+                    if ((item != "huge") && (item != "small"))
+                    {
+                        std::cerr << "zseb-bench: option -P takes huge and small" << std::endl;
+                        return 255;
+                    }
+                    page_kinds.push_back(item == "huge");
+                }
+                break;
+            }
+            case 'n':
+                repeats = atoi(optarg);
+                break;
+            case 'j':
+                json = true;
+                break;
+            case 'o':
+                outfile = optarg;
+                break;
+        }
+    }
+
+    if ((repeats == 0) || (repeats > 64))
+    {
+        std::cerr << "zseb-bench: option -n must be between 1 and 64" << std::endl;
+        return 255;
+    }
+    if (thread_counts.empty())
+    {
+        const uint32_t hardware = std::max(1U, std::thread::hardware_concurrency());
+        for (uint32_t threads = 1; threads <= hardware; threads *= 2){ thread_counts.push_back(threads); }
+    }
+
+    if (page_kinds.empty()){ page_kinds = { true, false }; }
+
+    std::vector<std::string> inputs;
+    DIR * folder = opendir(corpus.c_str());
+    if (folder == nullptr)
+    {
+        std::cerr << "zseb-bench: Unable to open " << corpus << "." << std::endl;
+        return 255;
+    }
+    struct stat info;
+    for (struct dirent * entry = readdir(folder); entry != nullptr; entry = readdir(folder))
+    {
+        const std::string name = corpus + "/" + entry->d_name;
+        if ((stat(name.c_str(), &info) == 0) && (S_ISREG(info.st_mode))){ inputs.push_back(entry->d_name); }
+    }
+    closedir(folder);
+    std::sort(inputs.begin(), inputs.end());
+    inputs.push_back("synthetic:zeros");
+    inputs.push_back("synthetic:random");
+    inputs.push_back("synthetic:repeats");
+
+    FILE * scratch = tmpfile();
+    if (scratch == nullptr)
+    {
+        std::cerr << "zseb-bench: Unable to create a scratch file." << std::endl;
+        return 255;
+    }
+
+    // Unzip is single-threaded for one member, so it runs after the zip with the most threads
+    std::vector<row> rows;
+    for (const std::string& name : inputs)
+    {
+        for (const uint32_t threads : thread_counts)
+        {
+            for (const bool huge : page_kinds){ rows.push_back(run(name, corpus, operation::zip, threads, huge, repeats, scratch)); }
+        }
+        rows.push_back(run(name, corpus, operation::unzip, 1, true, repeats, scratch));
+    }
+    fclose(scratch);
+
+    if (outfile.empty())
+        report(std::cout, rows, json);
+    else
+    {
+        std::ofstream output(outfile.c_str());
+        report(output, rows, json);
+    }
+    return 0;
+}
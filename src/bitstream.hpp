@@ -22,6 +22,8 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <streambuf>
+#include <vector>
 #include <assert.h>
 #include <stdint.h>
 #include <limits.h>
@@ -52,15 +54,60 @@ constexpr void int2str(uint32_t value, char * store, const uint16_t num) noexcep
 }
 
 
+// Read-only istream buffer over memory, without copying it
+class inbuf : public std::streambuf
+{
+    public:
+
+        inbuf(const char * data, const size_t size)
+        {
+            char * begin = const_cast<char *>(data);
+            setg(begin, begin, begin + size);
+        }
+};
+
+
+// ostream buffer which appends to a vector
+class outbuf : public std::streambuf
+{
+    public:
+
+        outbuf(std::vector<char>& store) : store(store) {}
+
+    protected:
+
+        int_type overflow(int_type value) override
+        {
+            if (value != traits_type::eof()){ store.push_back(static_cast<char>(value)); }
+            return value;
+        }
+
+        std::streamsize xsputn(const char * data, std::streamsize size) override
+        {
+            store.insert(store.end(), data, data + size);
+            return size;
+        }
+
+        pos_type seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode) override
+        {
+            return ((offset == 0) && (dir == std::ios_base::cur)) ? pos_type(store.size()) : pos_type(off_type(-1)); // Only for tellp
+        }
+
+    private:
+
+        std::vector<char>& store;
+};
+
+
 } // End of namespace stream
 
 
-// Bitwise wrapper for ifstream
+// Bitwise wrapper for ifstream (or any istream, e.g. for in-memory data)
 class ibstream
 {
     public:
 
-        ibstream(const std::string& smallfile) : data(0), ibit(0)
+        ibstream(const std::string& smallfile) : input(&ifile), data(0), ibit(0), lost(0)
         {
             ifile.open(smallfile.c_str(), std::ios::in|std::ios::binary);
             if (!ifile.is_open())
@@ -70,6 +117,8 @@ class ibstream
             }
         }
 
+        ibstream(std::istream& stream) : input(&stream), data(0), ibit(0), lost(0) {}
+
         ~ibstream()
         {
             if (ifile.is_open())
@@ -78,7 +127,39 @@ class ibstream
 
         uint64_t pos()
         {
-            return ifile.tellg();
+            return input->tellg();
+        }
+
+        uint64_t bit_pos()
+        {
+            return CHAR_BIT * pos() - ibit;
+        }
+
+        void seek(const uint64_t position)
+        {
+            input->clear();
+            input->seekg(position, std::ios::beg);
+            data = 0;
+            ibit = 0;
+            lost = 0;
+        }
+
+        void seek_bit(const uint64_t position)
+        {
+            seek(position / CHAR_BIT);
+            if (position % CHAR_BIT != 0)
+                read(position % CHAR_BIT);
+        }
+
+        int peek()
+        {
+            assert(ibit == 0);
+            return input->peek();
+        }
+
+        bool good()
+        {
+            return input->good();
         }
 
         void next_byte()
@@ -92,8 +173,9 @@ class ibstream
             assert(nbits <= 24);
             while (ibit < nbits)
             {
-                char toread;
-                ifile.read(&toread, 1);
+                char toread = 0; // Zero bits beyond the end of the input
+                if (!input->read(&toread, 1))
+                    ++lost;
                 const uint32_t toshift = static_cast<uint8_t>(toread);
                 data = data ^ (toshift << ibit);
                 ibit = ibit + CHAR_BIT;
@@ -109,30 +191,43 @@ class ibstream
         void read(char * buffer, const uint32_t size)
         {
             assert(ibit == 0);
-            ifile.read(buffer, size);
+            input->read(buffer, size);
+            lost += size - static_cast<uint32_t>(input->gcount());
+        }
+
+        // Bytes requested beyond the end of the input since the last seek; non-zero means truncated input
+        uint64_t missing() const
+        {
+            return lost;
         }
 
     private:
 
         std::ifstream ifile;
 
+        std::istream * input;
+
         uint32_t data; // Not yet completed byte
 
         uint16_t ibit; // Number of bits in not yet completed byte
 
+        uint64_t lost; // Bytes requested beyond the end of the input
+
 };
 
 
-// Bitwise wrapper for ofstream
+// Bitwise wrapper for ofstream (or any ostream, e.g. for in-memory data)
 class obstream
 {
     public:
 
-        obstream(const std::string& smallfile) : data(0), ibit(0)
+        obstream(const std::string& smallfile) : output(&ofile), data(0), ibit(0)
         {
             ofile.open(smallfile.c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
         }
 
+        obstream(std::ostream& stream) : output(&stream), data(0), ibit(0) {}
+
         ~obstream()
         {
             close();
@@ -146,29 +241,31 @@ class obstream
 
         uint64_t pos()
         {
-            return ofile.tellp();
+            return output->tellp();
         }
 
         void write(const uint32_t flush, const uint16_t nbits)
         {
             assert(flush == (flush & ((1U << nbits) - 1)));
-            assert(ibit + nbits <= 32);
-            data = data ^ (flush << ibit);
+            assert(ibit + nbits <= 64);
+            data = data ^ (static_cast<uint64_t>(flush) << ibit);
             ibit = ibit + nbits;
 
-            while (ibit >= CHAR_BIT)
+            // Four bytes per ostream call, so that ibit stays below 32 and any nbits <= 32 fits
+            if (ibit >= 32)
             {
-                const char towrite = static_cast<uint8_t>(data & UINT8_MAX);
-                ofile.write(&towrite, 1);
-                data = data >> CHAR_BIT;
-                ibit = ibit - CHAR_BIT;
+                const char towrite[4] = { static_cast<char>(data), static_cast<char>(data >> 8),
+                                          static_cast<char>(data >> 16), static_cast<char>(data >> 24) };
+                output->write(towrite, 4);
+                data = data >> 32;
+                ibit = ibit - 32;
             }
         }
 
         void write(const char * buffer, const uint32_t size)
         {
             assert(ibit == 0);
-            ofile.write(buffer, size);
+            output->write(buffer, size);
         }
 
         void flush()
@@ -176,7 +273,7 @@ class obstream
             while (ibit != 0)
             {
                 const char towrite = static_cast<uint8_t>(data & UINT8_MAX);
-                ofile.write(&towrite, 1);
+                output->write(&towrite, 1);
                 data = data >> CHAR_BIT;
                 ibit = ibit > CHAR_BIT ? ibit - CHAR_BIT : 0;
             }
@@ -186,9 +283,11 @@ class obstream
 
         std::ofstream ofile;
 
-        uint32_t data; // Not yet completed byte
+        std::ostream * output;
 
-        uint16_t ibit; // Number of bits in not yet completed byte
+        uint64_t data; // Not yet written bits
+
+        uint16_t ibit; // Number of not yet written bits
 
 };
 
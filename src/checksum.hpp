@@ -0,0 +1,50 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "dtypes.h"
+#include "crc32.hpp"
+#include "adler32.hpp"
+
+namespace zseb
+{
+
+
+constexpr uint32_t checksum_init(const zseb_format format) noexcept
+{
+    return format == zseb_format::zlib ? 1 : 0;
+}
+
+
+inline uint32_t checksum_update(const zseb_format format, const uint32_t checksum, const char * data, const uint32_t length) noexcept
+{
+    switch (format)
+    {
+        case zseb_format::gzip: return crc32::update(checksum, data, length);
+        case zseb_format::zlib: return adler32::update(checksum, data, length);
+        default:                return checksum; // Raw DEFLATE has no checksum
+    }
+}
+
+
+} // End of namespace zseb
+
@@ -0,0 +1,148 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+
+#include "huffman.h"
+#include "bitstream.hpp"
+#include "symbols.hpp"
+
+namespace zseb
+{
+namespace codes
+{
+
+// Fixed trees (paragraph 3.2.6 RFC 1951), as codons with the first bit as MSB
+constexpr uint8_t fixed_size(const uint16_t llen_code) noexcept
+{
+    return llen_code < 144 ? 8 : (llen_code < 256 ? 9 : (llen_code < 280 ? 7 : 8));
+}
+
+constexpr uint16_t fixed_code(const uint16_t llen_code) noexcept
+{
+    return llen_code < 144 ? 0x30 + llen_code : (llen_code < 256 ? 0x190 + llen_code - 144 : (llen_code < 280 ? llen_code - 256 : 0xc0 + llen_code - 280));
+}
+
+constexpr uint16_t reverse(const uint16_t code, const uint8_t nbits) noexcept
+{
+    uint16_t result = 0;
+    for (uint8_t bit = 0; bit < nbits; ++bit){ result = (result << 1) | ((code >> bit) & 1U); }
+    return result;
+}
+
+// Fill table.len and table.shift from the codons in table.llen and table.dist
+constexpr void merge(zseb_encode& table) noexcept
+{
+    for (uint16_t shift = 0; shift < 256; ++shift)
+    {
+        const uint16_t  len_code = symbols::len_code(static_cast<uint8_t>(shift));
+        const zseb_node& node    = table.llen[len_code];
+        zseb_code&       entry   = table.len[shift];
+        entry = { 0, 0, 0 };
+        if (node.info != 0)
+        {
+            entry.data = node.data ^ (static_cast<uint32_t>(shift - symbols::len_base(len_code)) << node.info);
+            entry.size = static_cast<uint8_t>(node.info + symbols::len_bits(len_code));
+        }
+    }
+
+    // Two levels as map_dist: shifts below 256 carry their extra bits, above only the codon (extra bits = low bits of the shift)
+    for (uint16_t idx = 0; idx < 512; ++idx)
+    {
+        const uint8_t dist_code = symbols::map_dist[idx];
+        zseb_code&    entry     = table.shift[idx];
+        entry = { 0, 0, 0 };
+        if ((dist_code < ZSEB_HUF_DIST) && (table.dist[dist_code].info != 0)) // Entries 256 and 257 are never looked up
+        {
+            const zseb_node& node = table.dist[dist_code];
+            if (idx < 256)
+            {
+                entry.data = node.data ^ (static_cast<uint32_t>(idx - symbols::add_dist[dist_code]) << node.info);
+                entry.size = static_cast<uint8_t>(node.info + symbols::bit_dist[dist_code]);
+            }
+            else
+            {
+                entry.data = node.data;
+                entry.size = static_cast<uint8_t>(node.info);
+                entry.plus = symbols::bit_dist[dist_code];
+            }
+        }
+    }
+}
+
+constexpr zseb_encode fixed_tables() noexcept
+{
+    zseb_encode table{};
+    for (uint16_t sym = 0; sym < ZSEB_HUF_LLEN; ++sym)
+        table.llen[sym] = { { sym, sym }, reverse(fixed_code(sym), fixed_size(sym)), fixed_size(sym) };
+    for (uint16_t sym = 0; sym < ZSEB_HUF_DIST; ++sym)
+        table.dist[sym] = { { sym, sym }, reverse(sym, 5), 5 };
+    merge(table);
+    return table;
+}
+
+constexpr const zseb_encode fixed_encode = fixed_tables();
+
+// Decoding reads 7 bits first (LSB first, as ibstream::read returns them): head gives the symbol of a 7 bit
+// codon (256-279), or the 7 bit MSB first prefix (below 256) of an 8 or 9 bit codon. Distances are 5 bit codons.
+struct decode_table
+{
+    uint16_t head[128];
+    uint8_t  dist[32];
+};
+
+constexpr decode_table fixed_decoder() noexcept
+{
+    decode_table table{};
+    for (uint16_t raw = 0; raw < 128; ++raw)
+    {
+        const uint16_t prefix = reverse(raw, 7);
+        table.head[raw] = prefix < 24 ? symbols::STOP + prefix : prefix;
+    }
+    for (uint16_t raw = 0; raw < 32; ++raw){ table.dist[raw] = static_cast<uint8_t>(reverse(raw, 5)); }
+    return table;
+}
+
+constexpr const decode_table fixed_decode = fixed_decoder();
+
+inline uint16_t fixed_llen(ibstream& zipfile)
+{
+    const uint16_t head = fixed_decode.head[zipfile.read(7)];
+    if (head >= symbols::STOP)
+        return head;                                     // 256-279
+    const uint16_t code = (head << 1) | zipfile.read(1);
+    if (code < 0xc0)
+        return code - 0x30;                              // 0-143
+    if (code < 0xc8)
+        return code - 0xc0 + 280;                        // 280-287
+    return ((code << 1) | zipfile.read(1)) - 0x190 + 144; // 144-255
+}
+
+inline uint16_t fixed_dist(ibstream& zipfile)
+{
+    return fixed_decode.dist[zipfile.read(5)];
+}
+
+
+} // End of namespace codes
+} // End of namespace zseb
+
@@ -0,0 +1,302 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "compressor.h"
+#include "checksum.hpp"
+#include "stats.hpp"
+#include "affinity.hpp"
+
+namespace zseb
+{
+
+
+compressor::compressor(const uint32_t num_threads, const uint32_t batch_size, const uint32_t first_slot) :
+    num_threads(num_threads),
+    batch_size(batch_size),
+    first_slot(first_slot),
+    multi_batch(num_threads * batch_size),
+    multi_trigger(num_threads * batch_size + lz77::HIST_SIZE),
+    tables(num_threads),
+    arena(num_threads, batch_size),
+    outputs(num_threads),
+    lzss_parts(num_threads),
+    num_blocks(0),
+    num_reused(0)
+{
+    assert((batch_size % lz77::HIST_SIZE == 0) && (batch_size >= 2 * lz77::HIST_SIZE) && (batch_size <= BATCH_SIZE));
+
+    // Anonymous pages: zero, page aligned and untouched, so that they can be interleaved over the NUMA nodes
+    void * data = pages::allocate(multi_trigger + FRAME_EXTRA, frame_mapped);
+    if (data == nullptr)
+    {
+        std::cerr << "zseb: Unable to allocate the frame." << std::endl;
+        exit(255);
+    }
+    affinity::interleave(data, frame_mapped);
+    frame = static_cast<char *>(data);
+
+    threads.reserve(num_threads);
+}
+
+
+// Called by the worker itself: after pinning, its hash chains are allocated and cleared on its own NUMA node
+lz77::chains& compressor::worker_chains(const uint32_t threadID)
+{
+    affinity::pin(first_slot + threadID);
+    if (!tables[threadID])
+        tables[threadID] = pages::make<lz77::chains>();
+    return *tables[threadID];
+}
+
+
+compressor::~compressor()
+{
+    pages::release(frame, frame_mapped);
+}
+
+
+uint32_t compressor::deflate(std::istream& origfile, const uint64_t size_file, obstream& zipfile, const zseb_format format,
+    const std::vector<char>& dictionary, uint64_t& size_lzss, uint64_t& time_lzss, uint64_t& time_huff)
+{
+    const uint32_t rd_base = std::min(static_cast<uint32_t>(dictionary.size()), lz77::HIST_SIZE); // Frame position of the first byte of origfile
+    std::copy(dictionary.end() - rd_base, dictionary.end(), frame);
+
+    uint32_t checksum   = checksum_init(format);
+    uint64_t rd_shift   = 0;
+    uint32_t rd_current = rd_base;
+
+    uint32_t rd_end = rd_base + (multi_batch > size_file ? size_file : multi_batch);
+    {
+        ZSEB_TIME(io_read);
+        origfile.read(frame + rd_base, rd_end - rd_base);
+    }
+    {
+        ZSEB_TIME(checksum);
+        checksum = checksum_update(format, checksum, frame + rd_base, rd_end - rd_base);
+    }
+    std::fill(frame + rd_end, frame + rd_end + FRAME_EXTRA, 0); // Lookahead past the data is independent of earlier calls
+
+    bool last_block = false;
+
+    bool   open_block = false; // Written header, but no stop codon yet
+    bool   open_final = false; // BFINAL of the open block
+    double open_ratio = 1.0;   // Codon bits over entropy of the block which built the open trees
+    double open_head  = 0.0;   // Bits of the tree header written for that block (0 if fixed)
+
+    num_blocks = 0;
+    num_reused = 0;
+
+    uint32_t carry_thread = num_threads; // Thread whose chains hashed the data up to rd_current, if any
+    uint64_t carry_window = 0;           // Data position (rd_shift + frame offset) of its last window
+
+    while ((!last_block) || (arena.size() != 0))
+    {
+        // LZSS a block: gzip packs (llen_pack, dist_pack) blocks of size 32767
+        auto start = std::chrono::steady_clock::now();
+        while ((!last_block) && (arena.size() < ZSEB_BLOCK_SIZE))
+        {
+            arena.slots(outputs);
+#ifdef ZSEB_STATS
+            std::vector<uint64_t> busy(num_threads, 0);
+            const uint64_t round = stats::now();
+#endif
+            // The first batch continues where the last batch of the previous round stopped: it runs on the worker which ran
+            // that batch, whose chains then skip re-hashing the history, and the other batches follow on the next workers.
+            // The chains stay with the worker that pinned itself and first touched them. With one thread, every batch after
+            // the first is carried.
+            const uint32_t lead = carry_thread < num_threads ? carry_thread : 0;
+            bool carried = false;
+            if (carry_thread < num_threads)
+            {
+                const uint64_t window = rd_shift + (rd_current > lz77::HIST_SIZE ? rd_current - lz77::HIST_SIZE : 0);
+                if ((window >= carry_window) && tables[carry_thread]->carry(window - carry_window, rd_current - (window - rd_shift)))
+                {
+                    carried = true;
+                    ZSEB_COUNT(lz77_carried, 1);
+                }
+            }
+            for (uint32_t batch = 0; batch < num_threads; ++batch)
+            {
+                const uint32_t offset = rd_current + batch * batch_size;
+                if (offset < rd_end)
+                {
+                    const uint32_t threadID = (lead + batch) % num_threads;
+                    const char * window = frame + (offset > lz77::HIST_SIZE ? offset - lz77::HIST_SIZE : 0);
+                    const char * start  = frame + offset;
+                    const char * end    = frame + std::min(rd_end, offset + batch_size);
+                    const bool resume   = carried && (batch == 0);
+                    carry_thread = threadID;
+                    carry_window = rd_shift + (window - frame);
+#ifdef ZSEB_STATS
+                    auto job = [this, batch, threadID, window, start, end, resume, &busy](){
+                        const uint64_t begin = stats::now();
+                        lzss_parts[batch] = lz77::deflate(window, start - window, end - window, worker_chains(threadID), outputs[batch], resume);
+                        stats::flush();
+                        const uint64_t finish = stats::now();
+                        stats::record(stats::lz77_batch, begin, finish);
+                        busy[threadID] = finish - begin;
+                    };
+#else
+                    auto job = [this, batch, threadID, window, start, end, resume](){
+                        lzss_parts[batch] = lz77::deflate(window, start - window, end - window, worker_chains(threadID), outputs[batch], resume);
+                    };
+#endif
+                    if (num_threads == 1)
+                    {
+                        affinity::keep mask; // The caller's thread is pinned only for the job
+                        job(); // No worker thread when there is nothing to overlap with
+                    }
+                    else
+                        threads.emplace_back(job);
+                }
+                else
+                    lzss_parts[batch] = 0;
+            }
+            {
+                ZSEB_TIME(join);
+                for (std::thread& t : threads)
+                    t.join();
+            }
+            threads.clear();
+#ifdef ZSEB_STATS
+            const uint64_t elapsed = stats::now() - round;
+            stats::record(stats::lz77_round, round, round + elapsed);
+            for (uint32_t threadID = 0; threadID < num_threads; ++threadID){ stats::worker(threadID, busy[threadID], elapsed); }
+#endif
+            const uint32_t upper = (rd_shift == 0) && (rd_current == rd_base) ? rd_base + multi_batch : multi_trigger;
+            rd_current = rd_end;
+
+            if (rd_end == upper)
+            {
+                const uint32_t shift = upper - lz77::HIST_SIZE;
+                if (shift != 0)
+                {
+                    assert(rd_end <= 2 * shift); // Requirement for std::copy (which does not allow overlapping pieces)
+                    std::copy(frame + shift, frame + rd_end, frame);
+                }
+                rd_shift  += shift;
+                rd_end     = lz77::HIST_SIZE;
+                rd_current = lz77::HIST_SIZE;
+
+                const uint64_t consumed     = rd_shift + lz77::HIST_SIZE - rd_base;
+                const uint32_t current_read = static_cast<uint32_t>(std::min<uint64_t>(multi_batch, size_file - consumed));
+                {
+                    ZSEB_TIME(io_read);
+                    origfile.read(frame + lz77::HIST_SIZE, current_read);
+                }
+                {
+                    ZSEB_TIME(checksum);
+                    checksum = checksum_update(format, checksum, frame + lz77::HIST_SIZE, current_read);
+                }
+                rd_end += current_read;
+            }
+
+            arena.append(outputs);
+            for (const uint32_t lzss : lzss_parts)
+                size_lzss += lzss;
+
+            last_block = rd_shift + rd_current - rd_base == size_file;
+        }
+        auto end = std::chrono::steady_clock::now();
+        time_lzss += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+        // Compute dynamic Huffman trees & X01 and X10 sizes
+        start = std::chrono::steady_clock::now();
+#ifdef ZSEB_STATS
+        const uint64_t block_start = zipfile.pos();
+#endif
+        uint32_t huffman_size = 0;
+        bool final_block = false;
+        {
+            ZSEB_TIME(tree_build);
+            huffman_size = arena.block(stat);
+            final_block = last_block && (huffman_size == arena.size());
+            // Keep packing into the open block when its trees code this histogram at most as well as a new tree
+            // is estimated to, namely with the redundancy over the entropy that the open trees had on their own block
+            bool reuse = false;
+            if (open_block)
+            {
+                const uint32_t keep = coder.reuse_cost(stat);
+                reuse = (keep != UINT32_MAX) && (keep <= open_ratio * huffman::entropy(stat) + open_head);
+            }
+            if (reuse)
+            {
+                num_reused += 1;
+                ZSEB_COUNT(blocks_reused, 1);
+                ZSEB_COUNT(block_tokens,  huffman_size);
+            }
+            else
+            {
+                if (open_block)
+                    coder.stop(zipfile);
+                coder.calc_tree(stat);
+                const uint32_t size_X1 = coder.get_size_X1();
+                const uint32_t size_X2 = coder.get_size_X2();
+                // What is the minimal output?
+                const uint32_t block_form = size_X2 < size_X1 ? 2 : 1;
+                zipfile.write(final_block ? 1 : 0, 1);
+                zipfile.write(block_form, 2);
+                // Write out
+                if (block_form == 2)
+                    coder.write_tree(zipfile);
+                else
+                    coder.fixed_tree('O');
+                const double bound = huffman::entropy(stat);
+                open_block = true;
+                open_final = final_block;
+                open_ratio = bound > 0 ? coder.reuse_cost(stat) / bound : 1.0;
+                open_head  = block_form == 2 ? coder.get_size_head() : 0;
+                ZSEB_COUNT(blocks_dynamic, block_form == 2 ? 1 : 0);
+                ZSEB_COUNT(blocks_fixed,   block_form == 1 ? 1 : 0);
+                ZSEB_COUNT(block_tokens,   huffman_size + 1);
+            }
+            num_blocks += 1;
+        }
+        {
+            ZSEB_TIME(pack);
+            coder.pack(zipfile, arena.tokens(), huffman_size);
+            if (final_block)
+            {
+                coder.stop(zipfile);
+                if (!open_final) // Reused trees: the open block was not marked final, so an empty fixed block follows
+                    zipfile.write(3, 10); // BFINAL '1', BTYPE '01' and the 7 bit fixed stop codon '0000000'
+            }
+        }
+        arena.consume(huffman_size);
+#ifdef ZSEB_STATS
+        ZSEB_COUNT(block_bytes, zipfile.pos() - block_start); // Whole bytes written; the pending bits count towards the next block
+#endif
+        end = std::chrono::steady_clock::now();
+        time_huff += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    }
+
+    return checksum;
+}
+
+
+
+
+} // End of namespace zseb
+
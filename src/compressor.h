@@ -0,0 +1,246 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <istream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "dtypes.h"
+#include "huffman.h"
+#include "bitstream.hpp"
+#include "lz77.hpp"
+#include "pages.hpp"
+
+namespace zseb
+{
+
+// Note that GZIP works with a frame of 65536 and shifts over 32768 whenever insufficient lookahead (MIN_LOOKAHEAD = 258 + 3 + 1)
+constexpr const uint32_t BATCH_SIZE   = 4 * lz77::HIST_SIZE;
+constexpr const uint32_t DISK_TRIGGER = BATCH_SIZE + lz77::HIST_SIZE;
+constexpr const uint32_t FRAME_EXTRA  = 272;
+
+constexpr const uint32_t ZSEB_BLOCK_SIZE = 32767; // GZIP packs in blocks of 32767
+constexpr const uint32_t ZSEB_ARRAY_SIZE = 98304;
+
+static_assert(lz77::SEGMENT <= ZSEB_BLOCK_SIZE, "every block holds at least one segment");
+
+
+// Storage for all tokens of one compression job, allocated once. Huffman blocks consume tokens and their segment
+// histograms from the front; an LZ77 round gives its batch t the slot at back + t * batch_size, after which the gaps are
+// closed. Rounds only start while fewer than ZSEB_BLOCK_SIZE tokens are queued, so ZSEB_BLOCK_SIZE + num_threads * batch_size suffices.
+class token_arena
+{
+    public:
+
+        token_arena(const uint32_t num_threads, const uint32_t batch_size) :
+            num_threads(num_threads),
+            batch_size(batch_size),
+            capacity(ZSEB_BLOCK_SIZE + num_threads * batch_size),
+            first(0),
+            last(0),
+            seg_first(0),
+            parts(num_threads)
+        {
+            store = new uint32_t[capacity];
+            const uint32_t per_slot = (batch_size + lz77::SEGMENT - 1) / lz77::SEGMENT;
+            queue.reserve(2 * num_threads * (per_slot + 1));
+            for (std::vector<lz77::segment>& part : parts){ part.reserve(per_slot); }
+        }
+
+        ~token_arena()
+        {
+            delete [] store;
+        }
+
+        token_arena(const token_arena&) = delete;
+        token_arena& operator=(const token_arena&) = delete;
+
+        uint32_t size() const{ return last - first; }
+
+        const uint32_t * tokens() const{ return store + first; }
+
+        // Output slots of an LZ77 round; moves the queued tokens to the front if the round might not fit
+        void slots(std::vector<lz77::tokens>& output)
+        {
+            assert(size() < ZSEB_BLOCK_SIZE);
+            if (last + num_threads * batch_size > capacity)
+            {
+                std::copy(store + first, store + last, store);
+                last -= first;
+                first = 0;
+            }
+            queue.erase(queue.begin(), queue.begin() + seg_first);
+            seg_first = 0;
+            for (uint32_t threadID = 0; threadID < num_threads; ++threadID)
+            {
+                parts[threadID].clear();
+                output[threadID] = { store + last + threadID * batch_size, 0, &parts[threadID] };
+            }
+        }
+
+        // Queue the tokens of the round, closing the gaps between the slots
+        void append(const std::vector<lz77::tokens>& output)
+        {
+            for (uint32_t threadID = 0; threadID < num_threads; ++threadID)
+            {
+                const lz77::tokens& item = output[threadID];
+                std::copy(item.store, item.store + item.size, store + last);
+                last += item.size;
+                queue.insert(queue.end(), parts[threadID].begin(), parts[threadID].end());
+            }
+        }
+
+        // Histogram of the next block: whole segments, as many as fit in ZSEB_BLOCK_SIZE tokens
+        uint32_t block(uint16_t * stat)
+        {
+            std::fill(stat, stat + symbols::NUM_LLEN + symbols::NUM_DIST, 0);
+            uint32_t num = 0;
+            for (uint32_t seg = seg_first; (seg < queue.size()) && (num + queue[seg].size <= ZSEB_BLOCK_SIZE); ++seg)
+            {
+                for (uint32_t sym = 0; sym < symbols::NUM_LLEN + symbols::NUM_DIST; ++sym){ stat[sym] += queue[seg].stat[sym]; }
+                num += queue[seg].size;
+            }
+            return num;
+        }
+
+        void consume(const uint32_t num)
+        {
+            for (uint32_t done = 0; done < num; ++seg_first){ done += queue[seg_first].size; }
+            first += num;
+            if (first == last){ first = 0; last = 0; }
+        }
+
+    private:
+
+        const uint32_t num_threads;
+
+        const uint32_t batch_size;
+
+        const uint32_t capacity;
+
+        uint32_t first;
+
+        uint32_t last;
+
+        uint32_t * store;
+
+        std::vector<lz77::segment> queue; // Histograms of the queued tokens, from seg_first on
+
+        uint32_t seg_first;
+
+        std::vector<std::vector<lz77::segment>> parts; // Per batch, histograms of its slot
+
+};
+
+
+// Workers and batch size of a compressor for size bytes, with at most max_threads workers: no more workers than batches,
+// and a single batch sized to the input if it is shorter than BATCH_SIZE, so that tiny inputs run on the calling thread
+// with a small frame. Batches only shrink when the input fits in one, so the output does not depend on max_threads.
+struct deflate_plan
+{
+    uint32_t num_threads;
+    uint32_t batch_size; // Multiple of HIST_SIZE, at least 2 * HIST_SIZE (see the frame shift of compressor::deflate)
+};
+
+inline deflate_plan plan(const uint64_t size, const uint32_t max_threads)
+{
+    const uint64_t batches = std::max<uint64_t>(1, (size + BATCH_SIZE - 1) / BATCH_SIZE);
+    const uint32_t workers = static_cast<uint32_t>(std::min<uint64_t>(std::max<uint32_t>(1, max_threads), batches));
+    if (size >= BATCH_SIZE)
+        return { workers, BATCH_SIZE };
+    const uint64_t rounded = (size + lz77::HIST_MASK) & ~static_cast<uint64_t>(lz77::HIST_MASK);
+    return { 1, static_cast<uint32_t>(std::max<uint64_t>(2 * lz77::HIST_SIZE, rounded)) };
+}
+
+
+// Long-lived deflate state: the frame, hash chains, token buffers and Huffman trees are allocated once,
+// so that compressing many small messages with the same compressor costs no allocations or table clears.
+class compressor
+{
+    public:
+
+        // batch_size: see deflate_plan. Worker t pins itself to affinity slot first_slot + t, so that compressors which
+        // run side by side (tools::zip_batch) do not share a CPU
+        compressor(const uint32_t num_threads, const uint32_t batch_size = BATCH_SIZE, const uint32_t first_slot = 0);
+
+        ~compressor();
+
+        compressor(const compressor&) = delete;
+        compressor& operator=(const compressor&) = delete;
+
+        // Deflate size_file bytes of origfile into DEFLATE blocks; returns the checksum of these bytes.
+        // The last HIST_SIZE bytes of the dictionary (if any) precede the data in the frame, as history for lz77::prepare.
+        uint32_t deflate(std::istream& origfile, const uint64_t size_file, obstream& zipfile, const zseb_format format,
+            const std::vector<char>& dictionary, uint64_t& size_lzss, uint64_t& time_lzss, uint64_t& time_huff);
+
+        uint32_t get_num_threads() const{ return num_threads; }
+
+        uint32_t get_batch_size() const{ return batch_size; }
+
+        // Blocks of at most ZSEB_BLOCK_SIZE tokens in the last deflate call, and those packed with the trees of the block before
+        uint64_t get_num_blocks() const{ return num_blocks; }
+
+        uint64_t get_num_reused() const{ return num_reused; }
+
+    private:
+
+        const uint32_t num_threads;
+
+        const uint32_t batch_size;
+
+        const uint32_t first_slot;
+
+        const uint32_t multi_batch;   // num_threads * batch_size
+
+        const uint32_t multi_trigger; // multi_batch + HIST_SIZE
+
+        char * frame; // Length multi_trigger + FRAME_EXTRA, in frame_mapped bytes of (huge) pages
+
+        size_t frame_mapped;
+
+        std::vector<pages::unique<lz77::chains>> tables; // Per thread, allocated by the worker on its first batch
+
+        lz77::chains& worker_chains(const uint32_t threadID);
+
+        token_arena arena;
+
+        std::vector<lz77::tokens> outputs; // Per batch of a round, slots in arena
+
+        uint16_t stat[symbols::NUM_LLEN + symbols::NUM_DIST]; // Histogram of the current block
+
+        std::vector<uint32_t> lzss_parts;
+
+        std::vector<std::thread> threads;
+
+        huffman coder;
+
+        uint64_t num_blocks;
+
+        uint64_t num_reused;
+
+};
+
+}
+
@@ -0,0 +1,240 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "decompressor.h"
+#include "lz77.hpp"
+#include "stats.hpp"
+
+namespace zseb
+{
+
+
+decompressor::decompressor() : state(phase::done), status(inflate_error::none), last_block(false), stored_left(0), emitted(0), next_token(0), block_end(false),
+    size_lzss(0), time_lzss(0), time_huff(0)
+{
+    frame.reserve(DISK_TRIGGER + FRAME_EXTRA);
+    llen_pack.reserve(TOKEN_CHUNK);
+    dist_pack.reserve(TOKEN_CHUNK);
+}
+
+
+decompressor::~decompressor(){}
+
+
+void decompressor::reset(const char * history, const uint32_t size)
+{
+    const uint32_t keep = std::min(size, lz77::HIST_SIZE);
+    frame.assign(history + size - keep, history + size);
+    emitted     = frame.size();
+    state       = phase::header;
+    status      = inflate_error::none;
+    last_block  = false;
+    stored_left = 0;
+    next_token  = 0;
+    block_end   = false;
+    llen_pack.clear();
+    dist_pack.clear();
+}
+
+
+// Advance the state machine by one header, one piece of a stored block or one chunk of tokens; requires all output handed out
+void decompressor::step(ibstream& zipfile)
+{
+    assert(emitted == frame.size());
+    if (frame.size() >= DISK_TRIGGER)
+    {
+        frame.erase(frame.begin(), frame.begin() + BATCH_SIZE);
+        emitted -= BATCH_SIZE;
+    }
+
+    switch (state)
+    {
+        case phase::header:
+        {
+            last_block = zipfile.read(1) == 1;
+            const uint32_t block_form = zipfile.read(2); // '10'_b dyn trees, '01'_b fixed trees, '00'_b uncompressed, '11'_b error
+            if (block_form == 3)
+                return fail(inflate_error::block_type);
+            if (block_form == 0)
+            {
+                zipfile.next_byte();
+                char vals[2];
+                zipfile.read(vals, 2); const uint16_t  LEN = static_cast<uint16_t>(stream::str2int(vals, 2));
+                zipfile.read(vals, 2); const uint16_t NLEN = static_cast<uint16_t>(stream::str2int(vals, 2));
+                const uint16_t NLEN2 = ~LEN;
+                if (zipfile.missing() != 0)
+                    return fail(inflate_error::truncated);
+                if (NLEN != NLEN2)
+                    return fail(inflate_error::stored_length);
+                stored_left = LEN;
+                state = phase::stored;
+                ZSEB_COUNT(blocks_stored, 1);
+            }
+            else
+            {
+                auto start = std::chrono::steady_clock::now();
+                inflate_error error = inflate_error::none;
+                {
+                    ZSEB_TIME(tree_load);
+                    if (block_form == 2) // Dynamic trees
+                        error = coder.load_tree(zipfile);
+                    else // Fixed trees
+                        coder.fixed_tree('I');
+                }
+                ZSEB_COUNT(blocks_dynamic, block_form == 2 ? 1 : 0);
+                ZSEB_COUNT(blocks_fixed,   block_form == 1 ? 1 : 0);
+                auto end = std::chrono::steady_clock::now();
+                time_huff += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+                if (zipfile.missing() != 0)
+                    return fail(inflate_error::truncated);
+                if (error != inflate_error::none)
+                    return fail(error);
+                llen_pack.clear();
+                dist_pack.clear();
+                next_token = 0;
+                block_end  = false;
+                state = phase::coded;
+            }
+            break;
+        }
+        case phase::stored:
+        {
+            const uint32_t todo = std::min(stored_left, DISK_TRIGGER - static_cast<uint32_t>(frame.size()));
+            frame.resize(frame.size() + todo);
+            zipfile.read(&frame[frame.size() - todo], todo);
+            if (zipfile.missing() != 0)
+            {
+                frame.resize(frame.size() - todo);
+                return fail(inflate_error::truncated);
+            }
+            stored_left -= todo;
+            if (stored_left == 0){ state = last_block ? phase::done : phase::header; }
+            break;
+        }
+        case phase::coded:
+        {
+            if (next_token == llen_pack.size())
+            {
+                if (block_end)
+                {
+                    state = last_block ? phase::done : phase::header;
+                    break;
+                }
+                auto start = std::chrono::steady_clock::now();
+                llen_pack.clear();
+                dist_pack.clear();
+                next_token = 0;
+                {
+                    ZSEB_TIME(unpack);
+                    block_end = coder.unpack(zipfile, llen_pack, dist_pack, TOKEN_CHUNK);
+                }
+                ZSEB_COUNT(block_tokens, llen_pack.size() + (block_end ? 1 : 0));
+                auto end = std::chrono::steady_clock::now();
+                time_huff += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+                if (zipfile.missing() != 0)
+                    return fail(inflate_error::truncated);
+                if ((!block_end) && (llen_pack.size() < TOKEN_CHUNK))
+                    return fail(inflate_error::symbol);
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            ZSEB_TIME(expand);
+            if (frame.size() >= lz77::HIST_SIZE)
+            {
+                // Fast path: distances are at most HIST_SIZE, and the frame never shrinks below it again
+                while ((next_token < llen_pack.size()) && (frame.size() < DISK_TRIGGER))
+                {
+                    size_lzss += lz77::inflate(frame, llen_pack[next_token], dist_pack[next_token]);
+                    ++next_token;
+                }
+            }
+            else
+            {
+                // Slow path: the first HIST_SIZE bytes of the stream (and history)
+                while ((next_token < llen_pack.size()) && (frame.size() < DISK_TRIGGER))
+                {
+                    if ((dist_pack[next_token] != UINT16_MAX) && (dist_pack[next_token] + lz77::DIS_SHIFT > frame.size()))
+                        return fail(inflate_error::distance);
+                    size_lzss += lz77::inflate(frame, llen_pack[next_token], dist_pack[next_token]);
+                    ++next_token;
+                }
+            }
+            auto end = std::chrono::steady_clock::now();
+            time_lzss += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+            if ((next_token == llen_pack.size()) && (block_end)){ state = last_block ? phase::done : phase::header; }
+            break;
+        }
+        case phase::done:
+            break;
+    }
+}
+
+
+void decompressor::fail(const inflate_error error)
+{
+    status = error;
+    state  = phase::done;
+}
+
+
+uint32_t decompressor::read(ibstream& zipfile, char * buffer, const uint32_t capacity)
+{
+    uint32_t produced = 0;
+    while (produced < capacity)
+    {
+        if (emitted < frame.size())
+        {
+            const uint32_t todo = static_cast<uint32_t>(std::min<size_t>(capacity - produced, frame.size() - emitted));
+            memcpy(buffer + produced, &frame[emitted], todo);
+            emitted  += todo;
+            produced += todo;
+        }
+        else if (state == phase::done)
+            break;
+        else
+            step(zipfile);
+    }
+    return produced;
+}
+
+
+uint32_t decompressor::next(ibstream& zipfile, const char *& data)
+{
+    while (emitted == frame.size())
+    {
+        if (state == phase::done){ return 0; }
+        const bool was_header = state == phase::header;
+        step(zipfile);
+        if ((!was_header) && (state == phase::header) && (emitted == frame.size())){ return 0; }
+    }
+    data = &frame[emitted];
+    const uint32_t size = static_cast<uint32_t>(frame.size() - emitted);
+    emitted = frame.size();
+    return size;
+}
+
+
+} // End of namespace zseb
+
@@ -0,0 +1,113 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "dtypes.h"
+#include "huffman.h"
+#include "bitstream.hpp"
+#include "compressor.h"
+
+namespace zseb
+{
+
+constexpr const uint32_t TOKEN_CHUNK = 4096; // Tokens decoded ahead of the frame
+
+
+// Resumable inflate of one DEFLATE stream in a fixed memory budget. The frame holds at most DISK_TRIGGER + 258
+// bytes and at most TOKEN_CHUNK tokens are decoded ahead, whatever the size of the blocks, so that inflation can
+// stop mid-block whenever the caller has no room for more output and continue later.
+// Corrupt or truncated input ends the stream early with error() set; no output derives from the corrupt part.
+class decompressor
+{
+    public:
+
+        decompressor();
+
+        ~decompressor();
+
+        // Start a new stream; the last HIST_SIZE bytes of history (e.g. a preset dictionary) precede it
+        void reset(const char * history = nullptr, const uint32_t size = 0);
+
+        // Inflate at most capacity bytes into buffer; returns the number of bytes written
+        uint32_t read(ibstream& zipfile, char * buffer, const uint32_t capacity);
+
+        // Zero-copy variant: data points into the frame and stays valid until the next call.
+        // Returns 0 at the end of the stream, and at each block boundary.
+        uint32_t next(ibstream& zipfile, const char *& data);
+
+        bool finished() const{ return (state == phase::done) && (emitted == frame.size()); }
+
+        inflate_error error() const{ return status; }
+
+        // Between blocks, with all output handed out: the next block header starts at zipfile.bit_pos()
+        bool at_block() const{ return (state == phase::header) && (emitted == frame.size()); }
+
+        // Ends with the most recent output; at least HIST_SIZE bytes unless the stream (and history) are shorter
+        const std::vector<char>& window() const{ return frame; }
+
+        uint64_t get_size_lzss() const{ return size_lzss; }
+
+        uint64_t get_time_lzss() const{ return time_lzss; }
+
+        uint64_t get_time_huff() const{ return time_huff; }
+
+    private:
+
+        enum class phase { header, stored, coded, done };
+
+        phase state;
+
+        inflate_error status;
+
+        bool last_block;
+
+        uint32_t stored_left; // Bytes of the stored block not yet read
+
+        std::vector<char> frame;
+
+        size_t emitted; // Bytes of the frame handed out, or history
+
+        std::vector<uint8_t>  llen_pack;
+
+        std::vector<uint16_t> dist_pack;
+
+        size_t next_token;
+
+        bool block_end; // The stop codon of the current block has been decoded
+
+        huffman coder;
+
+        uint64_t size_lzss;
+
+        uint64_t time_lzss;
+
+        uint64_t time_huff;
+
+        void step(ibstream& zipfile);
+
+        void fail(const inflate_error error);
+
+};
+
+}
+
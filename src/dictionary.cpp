@@ -0,0 +1,135 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+    Dictionary training, in the spirit of the COVER algorithm of zstd.
+
+    Each DMER byte sequence is scored by the number of samples in which it occurs. The concatenated
+    samples are divided in epochs, one per SEGMENT bytes of dictionary. In each epoch the SEGMENT
+    bytes with the largest sum of scores of their distinct DMERs are selected, after which the scores
+    of these DMERs are zeroed, so that later segments cover other content.
+*/
+
+#include <string.h>
+#include <algorithm>
+
+#include "dictionary.h"
+
+namespace zseb
+{
+namespace dictionary
+{
+
+constexpr const uint32_t DMER       = 8;        // Bytes per scored sequence
+constexpr const uint32_t SEGMENT    = 64;       // Bytes per selected segment
+constexpr const uint32_t HASH_BITS  = 20;
+constexpr const uint32_t HASH_SIZE  = 1U << HASH_BITS;
+
+
+inline uint32_t hash(const char * data) noexcept
+{
+    uint64_t work;
+    memcpy(&work, data, DMER);
+    return static_cast<uint32_t>((work * 0xcf1bbcdcb7a56463ULL) >> (64 - HASH_BITS));
+}
+
+
+std::vector<char> train(const std::vector<std::vector<char>>& samples, const uint32_t size)
+{
+    // Concatenate the samples; segments do not cross sample boundaries
+    std::vector<char> corpus;
+    std::vector<uint32_t> sample_end;
+    for (const std::vector<char>& sample : samples)
+    {
+        corpus.insert(corpus.end(), sample.begin(), sample.end());
+        sample_end.push_back(corpus.size());
+    }
+
+    // Score: number of samples containing the DMER
+    std::vector<uint32_t> score(HASH_SIZE, 0);
+    std::vector<uint32_t> last(HASH_SIZE, UINT32_MAX);
+    uint32_t begin = 0;
+    for (uint32_t item = 0; item < sample_end.size(); ++item)
+    {
+        for (uint32_t pos = begin; pos + DMER <= sample_end[item]; ++pos)
+        {
+            const uint32_t key = hash(&corpus[pos]);
+            if (last[key] != item){ score[key] += 1; last[key] = item; }
+        }
+        begin = sample_end[item];
+    }
+
+    std::vector<char> dictionary(std::min<size_t>(size, corpus.size()));
+    uint32_t filled = 0;
+    if (dictionary.size() < SEGMENT){ return std::vector<char>(); }
+
+    const uint32_t num_epoch = dictionary.size() / SEGMENT;
+    const uint32_t epoch_size = corpus.size() / num_epoch;
+    std::vector<uint16_t> active(HASH_SIZE, 0); // Occurrences of each DMER in the sliding segment
+
+    for (uint32_t epoch = 0; (epoch < num_epoch) && (filled + SEGMENT <= dictionary.size()); ++epoch)
+    {
+        const uint32_t epoch_begin = epoch * epoch_size;
+        const uint32_t epoch_end   = epoch_begin + epoch_size;
+
+        uint64_t best_score = 0;
+        uint32_t best_start = 0;
+        uint32_t item = std::upper_bound(sample_end.begin(), sample_end.end(), epoch_begin) - sample_end.begin();
+        uint32_t start = epoch_begin;
+        while ((start < epoch_end) && (item < sample_end.size()))
+        {
+            // Slide a window of SEGMENT bytes over [start, limit)
+            const uint32_t limit = std::min(sample_end[item], epoch_end + SEGMENT - 1);
+            uint64_t window = 0;
+            uint32_t first = start;
+            for (uint32_t pos = start; pos + DMER <= limit; ++pos)
+            {
+                const uint32_t key = hash(&corpus[pos]);
+                if (active[key]++ == 0){ window += score[key]; }
+                if (pos + DMER - first > SEGMENT)
+                {
+                    const uint32_t old = hash(&corpus[first++]);
+                    if (--active[old] == 0){ window -= score[old]; }
+                }
+                if ((pos + DMER - first == SEGMENT) && (window > best_score))
+                {
+                    best_score = window;
+                    best_start = first;
+                }
+            }
+            for (; first + DMER <= limit; ++first){ active[hash(&corpus[first])] -= 1; }
+
+            start = sample_end[item++];
+        }
+
+        if (best_score == 0){ continue; }
+
+        // Segments are placed from the back, so that the best ones end up closest to the data
+        filled += SEGMENT;
+        std::copy(corpus.begin() + best_start, corpus.begin() + best_start + SEGMENT, dictionary.end() - filled);
+        for (uint32_t pos = best_start; pos + DMER <= best_start + SEGMENT; ++pos){ score[hash(&corpus[pos])] = 0; }
+    }
+
+    dictionary.erase(dictionary.begin(), dictionary.end() - filled);
+    return dictionary;
+}
+
+}
+}
+
@@ -0,0 +1,37 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+
+namespace zseb
+{
+namespace dictionary
+{
+
+// Build a preset dictionary of at most size bytes from samples which resemble the data to be zipped.
+// The most valuable segments are placed at the end, closest to the data.
+std::vector<char> train(const std::vector<std::vector<char>>& samples, const uint32_t size);
+
+}
+}
+
@@ -37,7 +37,18 @@ enum zseb_modus
 {
     undefined,
     zip,
-    unzip
+    unzip,
+    index,
+    extract,
+    train,
+    estimate
+};
+
+enum zseb_format
+{
+    gzip, // RFC 1952
+    zlib, // RFC 1950
+    raw   // RFC 1951
 };
 
 /*
@@ -0,0 +1,437 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+// zseb-fuzz: fuzz and differential checks of inflate, of unzip of gzip and zlib containers and of zip round trips
+// against the system zlib.
+// Built with -DZSEB_LIBFUZZER -fsanitize=fuzzer (clang), LLVMFuzzerTestOneInput is the libFuzzer entry point;
+// otherwise main replays files or runs its own mutation loop over zlib streams of the corpus.
+
+#include <getopt.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dtypes.h"
+#include "zseb.h"
+#include "compressor.h"
+#include "decompressor.h"
+
+namespace
+{
+
+constexpr const size_t OUTPUT_LIMIT = 1U << 26; // Both inflaters stop here, so that small bombs stay cheap
+
+constexpr const unsigned CHILD_SECONDS = 10; // An unzip which takes longer hangs
+
+enum target : uint8_t { inflate_raw, roundtrip, container, NUM_TARGETS };
+
+void require(const bool condition, const char * what)
+{
+    if (!condition)
+    {
+        std::cerr << "zseb-fuzz: " << what << std::endl;
+        abort(); // Leaves the input to the fuzzer, or a core dump
+    }
+}
+
+
+// Reference: zlib with windowBits -15 (raw), 15 (zlib) or 31 (gzip); true if the stream ended properly
+bool zlib_inflate(const char * data, const size_t size, const int window_bits, std::vector<char>& output)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    require(inflateInit2(&stream, window_bits) == Z_OK, "inflateInit2 failed");
+    stream.next_in  = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream.avail_in = static_cast<uInt>(size);
+    output.clear();
+    int status = Z_OK;
+    char buffer[1U << 16];
+    while ((status == Z_OK) && (output.size() < OUTPUT_LIMIT))
+    {
+        stream.next_out  = reinterpret_cast<Bytef *>(buffer);
+        stream.avail_out = sizeof(buffer);
+        status = inflate(&stream, Z_NO_FLUSH);
+        output.insert(output.end(), buffer, buffer + (sizeof(buffer) - stream.avail_out));
+        if ((status == Z_BUF_ERROR) || ((status == Z_OK) && (stream.avail_in == 0) && (stream.avail_out != 0))){ break; } // Truncated
+    }
+    inflateEnd(&stream);
+    return status == Z_STREAM_END;
+}
+
+
+zseb::inflate_error zseb_inflate(const char * data, const size_t size, std::vector<char>& output)
+{
+    zseb::stream::inbuf input(data, size);
+    std::istream zipstream(&input);
+    zseb::ibstream zipfile(zipstream);
+    static zseb::decompressor inflater; // Reused, as tools::unzip reuses it across members
+    inflater.reset();
+    output.clear();
+    char buffer[1U << 16];
+    while ((!inflater.finished()) && (output.size() < OUTPUT_LIMIT))
+    {
+        const uint32_t produced = inflater.read(zipfile, buffer, sizeof(buffer));
+        output.insert(output.end(), buffer, buffer + produced);
+    }
+    return inflater.error();
+}
+
+
+// Any input: zseb and zlib agree on whether it is a valid raw DEFLATE stream, and on its contents
+void check_inflate(const char * data, const size_t size)
+{
+    std::vector<char> expected;
+    std::vector<char> actual;
+    const bool valid = zlib_inflate(data, size, -15, expected);
+    const zseb::inflate_error error = zseb_inflate(data, size, actual);
+
+    if ((expected.size() >= OUTPUT_LIMIT) || (actual.size() >= OUTPUT_LIMIT))
+    {
+        const size_t common = std::min(expected.size(), actual.size());
+        require(std::equal(expected.begin(), expected.begin() + common, actual.begin()), "inflate differs from zlib before the output limit");
+        return;
+    }
+    require(valid == (error == zseb::inflate_error::none), valid ? "zseb rejects a stream which zlib inflates" : "zseb accepts a stream which zlib rejects");
+    if (valid){ require(expected == actual, "inflate differs from zlib"); }
+}
+
+
+// Any input: zip with the container and compressor chosen by the first byte, then inflate with zlib and with zseb.
+// The compressor has 1 to 4 workers and batches of 2 * HIST_SIZE or BATCH_SIZE, so that longer inputs take several
+// LZ77 rounds, which carry the hash chains between batches and compact the token arena.
+void check_roundtrip(const char * data, const size_t size)
+{
+    const zseb::zseb_format formats[3] = { zseb::zseb_format::gzip, zseb::zseb_format::zlib, zseb::zseb_format::raw };
+    const int window_bits[3] = { 31, 15, -15 };
+    const uint32_t choice  = size == 0 ? 0 : static_cast<uint8_t>(data[0]);
+    const uint32_t format  = choice % 3;
+    const uint32_t workers = 1 + (choice / 3) % 4;
+    const uint32_t small   = (choice / 12) % 2;
+
+    static std::unique_ptr<zseb::compressor> deflaters[8]; // Reused, which exercises the lazily reset hash chains
+    std::unique_ptr<zseb::compressor>& deflater = deflaters[2 * (workers - 1) + small];
+    if (!deflater){ deflater.reset(new zseb::compressor(workers, small == 1 ? 2 * zseb::lz77::HIST_SIZE : zseb::BATCH_SIZE)); }
+    std::vector<char> zipped;
+    zseb::tools::zip(*deflater, data, size, zipped, formats[format]);
+
+    std::vector<char> expected;
+    require(zlib_inflate(zipped.data(), zipped.size(), window_bits[format], expected), "zlib rejects the output of zip");
+    require((expected.size() == size) && std::equal(expected.begin(), expected.end(), data), "zlib inflates the output of zip to different data");
+
+    std::vector<char> actual;
+    if (formats[format] == zseb::zseb_format::raw)
+        require(zseb_inflate(zipped.data(), zipped.size(), actual) == zseb::inflate_error::none, "zseb rejects the output of zip");
+    else
+    {
+        static zseb::decompressor inflater;
+        zseb::tools::unzip(inflater, zipped.data(), zipped.size(), actual, formats[format]); // Exits if rejected
+    }
+    require((actual.size() == size) && std::equal(actual.begin(), actual.end(), data), "zseb inflates the output of zip to different data");
+}
+
+
+// Any input: the first byte selects gzip or zlib, the rest is the container. As unzip ends the process on invalid
+// input, a child unzips it: the child must exit with 255 where zlib rejects the input, and otherwise agree with zlib.
+void check_container(const char * data, const size_t size)
+{
+    if (size == 0){ return; }
+    const zseb::zseb_format format = static_cast<uint8_t>(data[0]) % 2 == 0 ? zseb::zseb_format::gzip : zseb::zseb_format::zlib;
+    const char * stream = data + 1;
+    const size_t length = size - 1;
+
+    std::vector<char> expected;
+    const bool valid = zlib_inflate(stream, length, format == zseb::zseb_format::gzip ? 31 : 15, expected);
+    if (expected.size() >= OUTPUT_LIMIT){ return; } // Unzip has no output limit
+
+    std::cout.flush();
+    const pid_t child = fork();
+    require(child >= 0, "fork failed");
+    if (child == 0)
+    {
+        alarm(CHILD_SECONDS);
+        const int saved = dup(STDERR_FILENO);
+        const int quiet = open("/dev/null", O_WRONLY);
+        dup2(quiet, STDERR_FILENO); // Without the reasons for rejecting the input
+        zseb::decompressor inflater;
+        std::vector<char> actual;
+        zseb::tools::unzip(inflater, stream, length, actual, format);
+        dup2(saved, STDERR_FILENO);
+        require(valid, "zseb unzips a container which zlib rejects");
+        require(actual == expected, "zseb unzips a container to different data than zlib");
+        _exit(0);
+    }
+    int status = 0;
+    require(waitpid(child, &status, 0) == child, "waitpid failed");
+    require((!WIFSIGNALED(status)) || (WTERMSIG(status) != SIGALRM), "zseb hangs on a container");
+    require(WIFEXITED(status), "zseb crashes on a container, or disagrees with zlib (see above)");
+    require((WEXITSTATUS(status) == 0) || (WEXITSTATUS(status) == 255), "zseb exits with an unexpected status");
+    require((WEXITSTATUS(status) == 255) != valid, "zseb rejects a container which zlib unzips");
+}
+
+
+void run(const target which, const char * data, const size_t size)
+{
+    if (which == inflate_raw)
+        check_inflate(data, size);
+    else if (which == container)
+        check_container(data, size);
+    else
+        check_roundtrip(data, size);
+}
+
+}
+
+
+// First byte selects the target, the rest is its input
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+    if (size == 0){ return 0; }
+    run(static_cast<target>(data[0] % NUM_TARGETS), reinterpret_cast<const char *>(data + 1), size - 1);
+    return 0;
+}
+
+
+#ifndef ZSEB_LIBFUZZER
+
+namespace
+{
+
+void print_help()
+{
+std::cout << "\n"
+"zseb-fuzz: differential checks of zseb against the system zlib\n"
+"\n"
+"Usage: zseb-fuzz [OPTIONS] [files]\n"
+"\n"
+"    With files, each is replayed as a libFuzzer input (first byte\n"
+"    selects the target). Otherwise zlib streams of the corpus (levels\n"
+"    0-9, fixed, Huffman-only and RLE strategies) are mutated and\n"
+"    inflated by zseb and zlib, which must agree, and so are gzip and\n"
+"    zlib containers (with name, comment, extra field and header CRC),\n"
+"    which zseb unzips in a child process. Random slices of the corpus\n"
+"    are zipped by zseb with 1 to 4 workers and unzipped by zlib and\n"
+"    zseb.\n"
+"\n"
+"    ARGUMENTS\n"
+"        -c, --corpus=dir\n"
+"                Directory with the corpus files (default = calgary).\n"
+"\n"
+"        -n, --iterations=num\n"
+"                Mutated inputs (default = 10000).\n"
+"\n"
+"        -s, --seed=num\n"
+"                Seed of the mutations (default = 1).\n"
+"\n"
+"        -h, --help\n"
+"                Display this help.\n"
+"\n"
+" " << std::endl;
+}
+
+std::vector<char> load_file(const std::string& name)
+{
+    std::ifstream file(name.c_str(), std::ios::in|std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+// Raw DEFLATE with window_bits -15, zlib with 15 and gzip with 31; header (if any) fills the optional gzip fields
+std::vector<char> zlib_deflate(const std::vector<char>& data, const int level, const int strategy, const int window_bits = -15, gz_header * header = nullptr)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    require(deflateInit2(&stream, level, Z_DEFLATED, window_bits, 8, strategy) == Z_OK, "deflateInit2 failed");
+    if (header != nullptr){ require(deflateSetHeader(&stream, header) == Z_OK, "deflateSetHeader failed"); }
+    std::vector<char> output(deflateBound(&stream, data.size()));
+    stream.next_in   = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in  = static_cast<uInt>(data.size());
+    stream.next_out  = reinterpret_cast<Bytef *>(output.data());
+    stream.avail_out = static_cast<uInt>(output.size());
+    require(deflate(&stream, Z_FINISH) == Z_STREAM_END, "deflate failed");
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+    return output;
+}
+
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::string corpus = "calgary";
+    uint64_t iterations = 10000;
+    uint32_t seed = 1;
+
+    struct option long_options[] =
+    {
+        {"corpus",     required_argument, 0, 'c'},
+        {"iterations", required_argument, 0, 'n'},
+        {"seed",       required_argument, 0, 's'},
+        {"help",       no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "hc:n:s:", long_options, &option_index)) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+            case '?':
+                print_help();
+                return 0;
+            case 'c':
+                corpus = optarg;
+                break;
+            case 'n':
+                iterations = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+        }
+    }
+
+    if (optind < argc)
+    {
+        for (int idx = optind; idx < argc; ++idx)
+        {
+            const std::vector<char> input = load_file(argv[idx]);
+            LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(input.data()), input.size());
+        }
+        std::cout << "zseb-fuzz: " << argc - optind << " inputs passed" << std::endl;
+        return 0;
+    }
+
+    // Seeds: the first 64 KiB of each corpus file, deflated by zlib with various levels and strategies
+    std::vector<std::vector<char>> samples;
+    std::vector<std::vector<char>> files; // Whole, for round trips of several LZ77 rounds
+    DIR * folder = opendir(corpus.c_str());
+    if (folder == nullptr)
+    {
+        std::cerr << "zseb-fuzz: Unable to open " << corpus << "." << std::endl;
+        return 255;
+    }
+    struct stat info;
+    std::vector<std::string> names;
+    for (struct dirent * entry = readdir(folder); entry != nullptr; entry = readdir(folder))
+    {
+        const std::string name = corpus + "/" + entry->d_name;
+        if ((stat(name.c_str(), &info) == 0) && (S_ISREG(info.st_mode))){ names.push_back(name); }
+    }
+    closedir(folder);
+    std::sort(names.begin(), names.end());
+    for (const std::string& name : names)
+    {
+        std::vector<char> data = load_file(name);
+        files.push_back(data);
+        data.resize(std::min<size_t>(data.size(), 1U << 16));
+        samples.push_back(data);
+    }
+    samples.push_back(std::vector<char>(1U << 16, 0));
+    require(!samples.empty(), "empty corpus");
+
+    std::vector<std::vector<char>> seeds;
+    const int strategies[4] = { Z_DEFAULT_STRATEGY, Z_FIXED, Z_HUFFMAN_ONLY, Z_RLE };
+    for (size_t idx = 0; idx < samples.size(); ++idx)
+    {
+        for (int level = 0; level <= 9; ++level){ seeds.push_back(zlib_deflate(samples[idx], level, Z_DEFAULT_STRATEGY)); }
+        for (const int strategy : strategies){ seeds.push_back(zlib_deflate(samples[idx], 6, strategy)); }
+    }
+
+    // Container seeds, with the target byte of check_container in front: gzip with and without the optional fields, and zlib
+    std::vector<std::vector<char>> wrapped;
+    char name[]    = "name";
+    char comment[] = "comment";
+    char extra[]   = { 'B', 'C', 2, 0, 0, 0, 'Z', 'S', 1, 0, 7 };
+    gz_header header;
+    memset(&header, 0, sizeof(header));
+    header.name     = reinterpret_cast<Bytef *>(name);
+    header.comment  = reinterpret_cast<Bytef *>(comment);
+    header.extra    = reinterpret_cast<Bytef *>(extra);
+    header.extra_len = sizeof(extra);
+    header.hcrc     = 1;
+    for (size_t idx = 0; idx < samples.size(); ++idx)
+    {
+        wrapped.push_back(zlib_deflate(samples[idx], 6, Z_DEFAULT_STRATEGY, 31));
+        wrapped.back().insert(wrapped.back().begin(), 0);
+        wrapped.push_back(zlib_deflate(samples[idx], 1, Z_DEFAULT_STRATEGY, 31, &header));
+        wrapped.back().insert(wrapped.back().begin(), 0);
+        wrapped.push_back(zlib_deflate(samples[idx], 6, Z_DEFAULT_STRATEGY, 15));
+        wrapped.back().insert(wrapped.back().begin(), 1);
+    }
+
+    std::mt19937 generator(seed);
+    auto below = [&generator](const size_t bound){ return static_cast<size_t>(generator() % std::max<size_t>(bound, 1)); };
+    for (uint64_t iteration = 0; iteration < iterations; ++iteration)
+    {
+        if (iteration % 8 == 7)
+        {
+            // Round trip of a random slice
+            const std::vector<char>& data = files[below(files.size())];
+            const size_t start  = below(data.size());
+            const size_t length = below(data.size() - start + 1);
+            std::vector<char> input(1, static_cast<char>(roundtrip));
+            input.insert(input.end(), data.begin() + start, data.begin() + start + length);
+            LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(input.data()), input.size());
+            continue;
+        }
+
+        // Mutated zlib stream or container: bit flips, byte overwrites, truncation or a duplicated range, mostly near the headers
+        const bool wrap = iteration % 8 == 3;
+        const size_t skip = wrap ? 1 : 0; // Keep the container byte
+        std::vector<char> stream = wrap ? wrapped[below(wrapped.size())] : seeds[below(seeds.size())];
+        const uint32_t edits = 1 + below(4);
+        for (uint32_t edit = 0; (edit < edits) && (stream.size() > skip); ++edit)
+        {
+            const size_t position = skip + below(generator() % 2 == 0 ? std::min<size_t>(stream.size() - skip, 256) : stream.size() - skip);
+            switch (below(4))
+            {
+                case 0: stream[position] ^= static_cast<char>(1U << below(CHAR_BIT)); break;
+                case 1: stream[position]  = static_cast<char>(generator() & UINT8_MAX); break;
+                case 2: stream.resize(position); break;
+                default:
+                {
+                    const std::vector<char> piece(stream.begin() + position, stream.begin() + std::min(stream.size(), position + 1 + below(64)));
+                    stream.insert(stream.begin() + skip + below(stream.size() - skip), piece.begin(), piece.end());
+                }
+            }
+        }
+        stream.insert(stream.begin(), static_cast<char>(wrap ? container : inflate_raw));
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(stream.data()), stream.size());
+    }
+    std::cout << "zseb-fuzz: " << iterations << " inputs passed" << std::endl;
+    return 0;
+}
+
+#endif
@@ -18,140 +18,106 @@
 */
 
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
 #include "huffman.h"
+#include "symbols.hpp"
+#include "codes.hpp"
+#include "lz77.hpp"
 
-const uint8_t zseb::huffman::bit_len[ 29 ] = { 0, 0, 0, 0, 0, 0, 0, 0, 1,  1,  1,  1,  2,  2,  2,  2,  3,  3,  3,  3,  4,  4,  4,   4,   5,   5,   5,   5,   0 };
-
-const uint8_t zseb::huffman::add_len[ 29 ] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 255 };
-
-const uint8_t zseb::huffman::map_len[ 256 ] = {  0,  1,  2,  3,  4,  5,  6,  7,  8,  8,  9,  9, 10, 10, 11, 11,
-                                                 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15,
-                                                 16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17, 17,
-                                                 18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19, 19,
-                                                 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
-                                                 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,
-                                                 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
-                                                 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
-                                                 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
-                                                 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
-                                                 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25,
-                                                 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25,
-                                                 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
-                                                 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
-                                                 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27,
-                                                 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 28 };
-
-const uint8_t  zseb::huffman::bit_dist[ 30 ] = { 0, 0, 0, 0, 1, 1, 2,  2,  3,  3,  4,  4,  5,  5,   6,   6,   7,   7,   8,   8,    9,   9,    10,   10,   11,   11,   12,    12,    13,    13 };
-
-const uint16_t zseb::huffman::add_dist[ 30 ] = { 0, 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576 };
-
-const uint8_t  zseb::huffman::map_dist[ 512 ] = {  0,   1,   2,   3,   4,   4,   5,   5,   6,   6,   6,   6,   7,   7,   7,   7,
-                                                   8,   8,   8,   8,   8,   8,   8,   8,   9,   9,   9,   9,   9,   9,   9,   9,
-                                                  10,  10,  10,  10,  10,  10,  10,  10,  10,  10,  10,  10,  10,  10,  10,  10,
-                                                  11,  11,  11,  11,  11,  11,  11,  11,  11,  11,  11,  11,  11,  11,  11,  11,
-                                                  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,
-                                                  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,  12,
-                                                  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,
-                                                  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,  13,
-                                                  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,
-                                                  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,
-                                                  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,
-                                                  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,  14,
-                                                  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,
-                                                  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,
-                                                  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,
-                                                  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,  15,
-                                                 255, 255,  16,  17,  18,  18,  19,  19,  20,  20,  20,  20,  21,  21,  21,  21,
-                                                  22,  22,  22,  22,  22,  22,  22,  22,  23,  23,  23,  23,  23,  23,  23,  23,
-                                                  24,  24,  24,  24,  24,  24,  24,  24,  24,  24,  24,  24,  24,  24,  24,  24,
-                                                  25,  25,  25,  25,  25,  25,  25,  25,  25,  25,  25,  25,  25,  25,  25,  25,
-                                                  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,
-                                                  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,  26,
-                                                  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,
-                                                  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,  27,
-                                                  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,
-                                                  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,
-                                                  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,
-                                                  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,  28,
-                                                  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,
-                                                  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,
-                                                  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,
-                                                  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29,  29 };
+static_assert(ZSEB_HUF_LLEN == zseb::symbols::NUM_LLEN, "symbol alphabets differ");
+static_assert(ZSEB_HUF_DIST == zseb::symbols::NUM_DIST, "symbol alphabets differ");
 
 const uint8_t zseb::huffman::map_ssq[ 19 ] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 }; // at pos = 0, sym = '16' (rep previous)
 
-zseb::huffman::huffman(){
+zseb::huffman::huffman() : encode(&dynamic), fixed(false){}
 
-   stat_comb = new  uint16_t[ ZSEB_HUF_COMBI ];
-   stat_ssq  = new  uint16_t[ ZSEB_HUF_SSQ   ];
-   tree_llen = new zseb_node[ ZSEB_HUF_TREE_LLEN ];
-   tree_dist = new zseb_node[ ZSEB_HUF_TREE_DIST ];
-   tree_ssq  = new zseb_node[ ZSEB_HUF_TREE_SSQ  ];
-   work      = new      bool[ ZSEB_HUF_TREE_LLEN ];
+zseb::huffman::~huffman(){}
 
-}
-
-zseb::huffman::~huffman(){
+zseb::inflate_error zseb::huffman::load_tree(ibstream& zipfile)
+{
+    fixed = false;
+    for (uint32_t cnt = 0; cnt < ZSEB_HUF_COMBI; ++cnt){ stat_comb[cnt] = 0; }
+    for (uint32_t cnt = 0; cnt < ZSEB_HUF_SSQ;   ++cnt){ stat_ssq [cnt] = 0; }
 
-   delete [] stat_comb;
-   delete [] stat_ssq;
-   delete [] tree_llen;
-   delete [] tree_dist;
-   delete [] tree_ssq;
-   delete [] work;
+    HLIT  = static_cast<uint16_t>(zipfile.read(5) + 257);
+    HDIST = static_cast<uint16_t>(zipfile.read(5) + 1);
+    HCLEN = static_cast<uint16_t>(zipfile.read(4) + 4);
+    if ((HLIT > 286) || (HDIST > 30))
+        return inflate_error::code_lengths;
 
-}
+    for (uint16_t idx_pos = 0; idx_pos < HCLEN; ++idx_pos)
+        stat_ssq[map_ssq[idx_pos]] = static_cast<uint16_t>(zipfile.read(3)); // CCL of RLE symbols; stat_ssq in idx_sym
 
-uint16_t zseb::huffman::__len_code__( const uint8_t len_shft ){
+    // Paragraph 3.2.2 RFC 1951: only complete codes define a tree in which every bit sequence ends in a leaf
+    if (!__valid_code__(stat_ssq, ZSEB_HUF_SSQ, ZSEB_MAX_BITS_SSQ, false))
+        return inflate_error::code_lengths;
 
-   return ( ZSEB_256_16T ^ ( 1 + map_len[ len_shft ] ) );
+    // Build tree: on output tree[ idx ].( info, data ) = bit ( length, sequence ) of SSQ; tree_ssq in idx_sym
+    __build_tree__(stat_ssq, ZSEB_HUF_SSQ, tree_ssq, work, 'I', ZSEB_MAX_BITS_SSQ);
 
-}
+    // Quote from RFC 1951: all CL form a single sequence of HLIT + HDIST + 258 values
+    if (!__CL_unpack__(zipfile, tree_ssq, HLIT + HDIST, stat_comb))
+        return inflate_error::code_lengths;
+    uint16_t * stat_dist = stat_comb + HLIT;
 
-uint8_t zseb::huffman::__len_bits__( const uint16_t len_code ){
+    // A single code of one bit, or no distance codes at all, is allowed (as in zlib)
+    if ((stat_comb[ZSEB_LITLEN] == 0) || (!__valid_code__(stat_comb, HLIT, ZSEB_MAX_BITS_LLD, true)))
+        return inflate_error::literal_lengths;
+    if (!__valid_code__(stat_dist, HDIST, ZSEB_MAX_BITS_LLD, true))
+        return inflate_error::distances;
 
-   return bit_len[ ZSEB_256_16T ^ ( len_code - 1 ) ];
+    // Build trees
+    if (!__degenerate_tree__(stat_comb, HLIT , tree_llen)){ __build_tree__(stat_comb, HLIT , tree_llen, work, 'I', ZSEB_MAX_BITS_LLD); }
+    if (!__degenerate_tree__(stat_dist, HDIST, tree_dist)){ __build_tree__(stat_dist, HDIST, tree_dist, work, 'I', ZSEB_MAX_BITS_LLD); }
 
+    return inflate_error::none;
 }
 
-uint8_t zseb::huffman::__len_base__( const uint16_t len_code ){
-
-   return add_len[ ZSEB_256_16T ^ ( len_code - 1 ) ];
+bool zseb::huffman::__valid_code__( const uint16_t * stat, const uint16_t size, const uint16_t ZSEB_MAX_BITS, const bool degenerate ){
 
-}
+   uint16_t bl_count[ ZSEB_MAX_BITS + 1 ];
+   for ( uint16_t nbits = 0; nbits <= ZSEB_MAX_BITS; nbits++ ){ bl_count[ nbits ] = 0; }
+   for ( uint16_t   idx = 0; idx < size; idx++ ){ bl_count[ stat[ idx ] ] += 1; }
 
-uint8_t zseb::huffman::__dist_code__( const uint16_t dist_shft ){
+   // Unused bit sequences of each length, Kraft
+   int32_t left = 1;
+   for ( uint16_t nbits = 1; nbits <= ZSEB_MAX_BITS; nbits++ ){
+      left = 2 * left - bl_count[ nbits ];
+      if ( left < 0 ){ return false; } // Over-subscribed
+   }
+   if ( left == 0 ){ return true; }
 
-   return ( ( dist_shft < ZSEB_256_16T ) ? map_dist[ dist_shft ] : map_dist[ ZSEB_256_16T ^ ( dist_shft >> 7 ) ] );
+   const uint16_t num = size - bl_count[ 0 ];
+   return ( degenerate ) && ( ( num == 0 ) || ( ( num == 1 ) && ( bl_count[ 1 ] == 1 ) ) );
 
 }
 
-void zseb::huffman::load_tree(ibstream& zipfile)
-{
-    for (uint32_t cnt = 0; cnt < ZSEB_HUF_COMBI; ++cnt){ stat_comb[cnt] = 0; }
-    for (uint32_t cnt = 0; cnt < ZSEB_HUF_SSQ;   ++cnt){ stat_ssq [cnt] = 0; }
-
-    HLIT  = static_cast<uint16_t>(zipfile.read(5) + 257);
-    HDIST = static_cast<uint16_t>(zipfile.read(5) + 1);
-    HCLEN = static_cast<uint16_t>(zipfile.read(4) + 4);
+// Trees for codes with fewer than two symbols, which __build_tree__ does not handle; false if not degenerate
+bool zseb::huffman::__degenerate_tree__( const uint16_t * stat, const uint16_t size, zseb_node * tree ){
 
-    for (uint16_t idx_pos = 0; idx_pos < HCLEN; ++idx_pos)
-        stat_ssq[map_ssq[idx_pos]] = static_cast<uint16_t>(zipfile.read(3)); // CCL of RLE symbols; stat_ssq in idx_sym
+   uint16_t num = 0;
+   uint16_t sym = 0;
+   for ( uint16_t idx = 0; idx < size; idx++ ){ if ( stat[ idx ] != 0 ){ num += 1; sym = idx; } }
 
-    // Build tree: on output tree[ idx ].( info, data ) = bit ( length, sequence ) of SSQ; tree_ssq in idx_sym
-    __build_tree__(stat_ssq, ZSEB_HUF_SSQ, tree_ssq, work, 'I', ZSEB_MAX_BITS_SSQ);
+   if ( num == 0 ){ // Any symbol is invalid
+      tree[ 0 ].child[ 0 ] = UINT16_MAX;
+      tree[ 0 ].child[ 1 ] = UINT16_MAX;
+   }
+   if ( num == 1 ){ // Bit '0' is sym, bit '1' is invalid
+      tree[ 0 ].child[ 0 ] = 1;
+      tree[ 0 ].child[ 1 ] = 2;
+      tree[ 1 ].child[ 0 ] = sym;
+      tree[ 1 ].child[ 1 ] = sym;
+      tree[ 2 ].child[ 0 ] = UINT16_MAX;
+      tree[ 2 ].child[ 1 ] = UINT16_MAX;
+   }
 
-    // Quote from RFC 1951: all CL form a single sequence of HLIT + HDIST + 258 values
-    __CL_unpack__(zipfile, tree_ssq, HLIT + HDIST, stat_comb);
-    uint16_t * stat_dist = stat_comb + HLIT;
+   return ( num <= 1 );
 
-    // Build trees
-    __build_tree__(stat_comb, HLIT , tree_llen, work, 'I', ZSEB_MAX_BITS_LLD);
-    __build_tree__(stat_dist, HDIST, tree_dist, work, 'I', ZSEB_MAX_BITS_LLD);
 }
 
-void zseb::huffman::calc_tree( uint8_t * llen_pack, uint16_t * dist_pack, const uint32_t size ){
+void zseb::huffman::calc_tree( const uint16_t * histogram ){
 
    size_X1 = 3; //   Fixed Huffman tree: X01
    size_X2 = 3; // Dynamic Huffman tree: X10
@@ -159,29 +125,20 @@ void zseb::huffman::calc_tree( uint8_t * llen_pack, uint16_t * dist_pack, const
    uint16_t * stat_llen = stat_comb;
    uint16_t * stat_dist = stat_llen + ZSEB_HUF_LLEN;
 
-   for ( uint16_t cnt = 0; cnt < ZSEB_HUF_COMBI; cnt++ ){ stat_comb[ cnt ] = 0; }
+   // Statistics were gathered during LZ77
+   for ( uint16_t cnt = 0; cnt < ZSEB_HUF_COMBI; cnt++ ){ stat_comb[ cnt ] = histogram[ cnt ]; }
    for ( uint16_t cnt = 0; cnt < ZSEB_HUF_SSQ;   cnt++ ){ stat_ssq [ cnt ] = 0; }
 
    // Stop codon also needs a huffman code
    stat_llen[ ZSEB_LITLEN ] = 1;
 
-   // Gather statistics
-   for ( uint32_t count = 0; count < size; count++ ){
-      if ( dist_pack[ count ] == ZSEB_MASK_16T ){
-         stat_llen[ llen_pack[ count ] ] += 1; // lit_code == lit
-      } else {
-         stat_llen[  __len_code__( llen_pack[ count ] ) ] += 1;
-         stat_dist[ __dist_code__( dist_pack[ count ] ) ] += 1;
-      }
-   }
-
    // Fixed Huffman tree contributions 'pack' function
    for ( uint16_t cnt = 0;   cnt < 144; cnt++ ){ size_X1 += (   8                         * stat_llen[ cnt ] ); } // '8' x 144
    for ( uint16_t cnt = 144; cnt < 256; cnt++ ){ size_X1 += (   9                         * stat_llen[ cnt ] ); } // '9' x 112
                                                { size_X1 += (   7                         * stat_llen[ 256 ] ); } // '7' x 1 (STOP CODON)
-   for ( uint16_t cnt = 257; cnt < 280; cnt++ ){ size_X1 += ( ( 7 + __len_bits__( cnt ) ) * stat_llen[ cnt ] ); } // '7' x 23
-   for ( uint16_t cnt = 280; cnt < 286; cnt++ ){ size_X1 += ( ( 8 + __len_bits__( cnt ) ) * stat_llen[ cnt ] ); } // '8' x 6 (286, 287 not encountered)
-   for ( uint16_t cnt = 0;   cnt < 30;  cnt++ ){ size_X1 += ( ( 5 +     bit_dist[ cnt ] ) * stat_dist[ cnt ] ); } // All dist CL 5 (30, 31 not encountered)
+   for ( uint16_t cnt = 257; cnt < 280; cnt++ ){ size_X1 += ( ( 7 + symbols::len_bits( cnt ) ) * stat_llen[ cnt ] ); } // '7' x 23
+   for ( uint16_t cnt = 280; cnt < 286; cnt++ ){ size_X1 += ( ( 8 + symbols::len_bits( cnt ) ) * stat_llen[ cnt ] ); } // '8' x 6 (286, 287 not encountered)
+   for ( uint16_t cnt = 0;   cnt < 30;  cnt++ ){ size_X1 += ( ( 5 + symbols::bit_dist[ cnt ] ) * stat_dist[ cnt ] ); } // All dist CL 5 (30, 31 not encountered)
 
    // Huffman CL: input(stat) = freq; output(stat) = CL; output(tree)[ pack < num ].{info, data} = {bit length, frequency}
    const uint16_t num_llen = __prefix_lengths__( stat_llen, ZSEB_HUF_LLEN, tree_llen, work, ZSEB_MAX_BITS_LLD );
@@ -190,12 +147,12 @@ void zseb::huffman::calc_tree( uint8_t * llen_pack, uint16_t * dist_pack, const
    // Dynamic Huffman tree contributions 'pack' function
    for ( uint16_t cnt = 0; cnt < num_llen; cnt++ ){
       const uint16_t len_code = tree_llen[ cnt ].child[ 0 ];
-      const uint16_t len_nbit = ( ( len_code > ZSEB_LITLEN ) ? __len_bits__( len_code ) : 0 );
+      const uint16_t len_nbit = ( ( len_code > ZSEB_LITLEN ) ? symbols::len_bits( len_code ) : 0 );
       size_X2 += ( ( tree_llen[ cnt ].info + len_nbit ) * tree_llen[ cnt ].data );
    }
    for ( uint16_t cnt = 0; cnt < num_dist; cnt++ ){
       const uint16_t dist_code = tree_dist[ cnt ].child[ 0 ];
-      const uint16_t dist_nbit = bit_dist[ dist_code ];
+      const uint16_t dist_nbit = symbols::bit_dist[ dist_code ];
       size_X2 += ( ( tree_dist[ cnt ].info + dist_nbit ) * tree_dist[ cnt ].data );
    }
 
@@ -206,6 +163,7 @@ void zseb::huffman::calc_tree( uint8_t * llen_pack, uint16_t * dist_pack, const
    // Build tree: on output tree[ idx ].( info, data ) = bit ( length, inverse[sequence] )
    __build_tree__( stat_llen, HLIT , tree_llen, work, 'O', ZSEB_MAX_BITS_LLD );
    __build_tree__( stat_dist, HDIST, tree_dist, work, 'O', ZSEB_MAX_BITS_LLD );
+   __encode_tables__();
 
    // Quote from RFC 1951: all code lengths form a single sequence of HLIT + HDIST + 258 values
    for ( uint16_t count = 0; count < HDIST; count++ ){
@@ -225,13 +183,14 @@ void zseb::huffman::calc_tree( uint8_t * llen_pack, uint16_t * dist_pack, const
    HCLEN = ZSEB_HUF_SSQ; while ( ( stat_ssq[ map_ssq[ HCLEN - 1 ] ] == 0 ) && ( HCLEN > 4 ) ){ HCLEN -= 1; }
 
    // Dynamic Huffman tree contributions 'write_tree' function
-   size_X2 += ( 5 + 5 + 4 ); // HLIT, HDIST, HCLEN
-   size_X2 += ( HCLEN * 3 ); // stat_ssq
+   size_head  = ( 5 + 5 + 4 ); // HLIT, HDIST, HCLEN
+   size_head += ( HCLEN * 3 ); // stat_ssq
    for ( uint16_t cnt = 0; cnt < num_ssq; cnt++ ){ // stat_comb
       const uint16_t ssq_code = tree_ssq[ cnt ].child[ 0 ];
       const uint16_t ssq_nbit = ( ( ssq_code >= 16 ) ? ( ( ssq_code == 16 ) ? 2 : ( ( ssq_code == 17 ) ? 3 : 7 ) ) : 0 );
-      size_X2 += ( ( tree_ssq[ cnt ].info + ssq_nbit ) * tree_ssq[ cnt ].data );
+      size_head += ( ( tree_ssq[ cnt ].info + ssq_nbit ) * tree_ssq[ cnt ].data );
    }
+   size_X2 += size_head;
 
    // Build tree: on output tree[ idx ].( info, data ) = bit ( length, reverse[sequence] ); tree_ssq in idx_sym
    __build_tree__( stat_ssq, ZSEB_HUF_SSQ, tree_ssq, work, 'O', ZSEB_MAX_BITS_SSQ );
@@ -264,22 +223,14 @@ void zseb::huffman::fixed_tree( const char modus ){
 
    assert( ( modus == 'I' ) || ( modus == 'O' ) );
 
-   uint16_t * stat_llen = stat_comb;
-   uint16_t * stat_dist = stat_llen + ZSEB_HUF_LLEN;
-
-   for ( uint16_t cnt = 0;   cnt < 144; cnt++ ){ stat_llen[ cnt ] = 8; } // '8' x 144
-   for ( uint16_t cnt = 144; cnt < 256; cnt++ ){ stat_llen[ cnt ] = 9; } // '9' x 112
-   for ( uint16_t cnt = 256; cnt < 280; cnt++ ){ stat_llen[ cnt ] = 7; } // '7' x 24
-   for ( uint16_t cnt = 280; cnt < 288; cnt++ ){ stat_llen[ cnt ] = 8; } // '8' x 8
-   for ( uint16_t cnt = 0;   cnt < 32;  cnt++ ){ stat_dist[ cnt ] = 5; } // All dist CL 5
-
-   // Build trees
-   __build_tree__( stat_llen, ZSEB_HUF_LLEN, tree_llen, work, modus, ZSEB_MAX_BITS_LLD );
-   __build_tree__( stat_dist, ZSEB_HUF_DIST, tree_dist, work, modus, ZSEB_MAX_BITS_LLD );
+   // No per-block work: pack and unpack use the constexpr tables in codes.hpp
+   if ( modus == 'O' ){ encode = &codes::fixed_encode; }
+   if ( modus == 'I' ){ fixed = true; }
 
 }
 
-void zseb::huffman::unpack(ibstream& zipfile, std::vector<uint8_t>& llen_pack, std::vector<uint16_t>& dist_pack)
+template<bool FIXED>
+bool zseb::huffman::__unpack__(ibstream& zipfile, std::vector<uint8_t>& llen_pack, std::vector<uint16_t>& dist_pack, const size_t limit)
 {
     assert(llen_pack.size() == 0);
     assert(dist_pack.size() == 0);
@@ -287,7 +238,12 @@ void zseb::huffman::unpack(ibstream& zipfile, std::vector<uint8_t>& llen_pack, s
 
     while (llen_code != ZSEB_LITLEN)
     {
-        llen_code = __get_sym__(zipfile, tree_llen);
+        if (llen_pack.size() >= limit)
+            return false;
+
+        llen_code = FIXED ? codes::fixed_llen(zipfile) : __get_sym__(zipfile, tree_llen);
+        if (llen_code > 285) // 286 and 287 unused
+            return false;
 
         if (llen_code < ZSEB_LITLEN) // unpack literal
         {
@@ -297,14 +253,16 @@ void zseb::huffman::unpack(ibstream& zipfile, std::vector<uint8_t>& llen_pack, s
 
         if (llen_code > ZSEB_LITLEN) // unpack (length, distance) pair
         {
-            uint16_t len_shft = __len_base__(llen_code);
-            uint16_t len_nbit = __len_bits__(llen_code);
+            uint16_t len_shft = symbols::len_base(llen_code);
+            uint16_t len_nbit = symbols::len_bits(llen_code);
             if (len_nbit != 0)
                 len_shft = len_shft + static_cast<uint16_t>(zipfile.read(len_nbit));
 
-            uint16_t dis_code = __get_sym__(zipfile, tree_dist);
-            uint16_t dis_shft = add_dist[dis_code];
-            uint16_t dis_nbit = bit_dist[dis_code];
+            uint16_t dis_code = FIXED ? codes::fixed_dist(zipfile) : __get_sym__(zipfile, tree_dist);
+            if (dis_code > 29) // 30 and 31 unused
+                return false;
+            uint16_t dis_shft = symbols::add_dist[dis_code];
+            uint16_t dis_nbit = symbols::bit_dist[dis_code];
             if (dis_nbit != 0)
                 dis_shft = dis_shft + static_cast<uint16_t>(zipfile.read(dis_nbit));
 
@@ -312,33 +270,78 @@ void zseb::huffman::unpack(ibstream& zipfile, std::vector<uint8_t>& llen_pack, s
             dist_pack.push_back(dis_shft);
         }
     }
+    return true;
+}
+
+bool zseb::huffman::unpack(ibstream& zipfile, std::vector<uint8_t>& llen_pack, std::vector<uint16_t>& dist_pack, const size_t limit)
+{
+    return fixed ? __unpack__<true>(zipfile, llen_pack, dist_pack, limit) : __unpack__<false>(zipfile, llen_pack, dist_pack, limit);
 }
 
-void zseb::huffman::pack(obstream& zipfile, uint8_t * llen_pack, uint16_t * dist_pack, const uint32_t size)
+void zseb::huffman::pack(obstream& zipfile, const uint32_t * tokens, const uint32_t size)
 {
     for (uint32_t idx = 0; idx < size; ++idx)
     {
-      if ( dist_pack[ idx ] == ZSEB_MASK_16T ){
-         const uint16_t lit_code = llen_pack[ idx ];
-         zipfile.write( tree_llen[ lit_code ].data, tree_llen[ lit_code ].info ); // Literal
+      const uint32_t value = tokens[ idx ];
+      if ( !lz77::token::is_pair( value ) ){
+         zipfile.write( encode->llen[ value ].data, encode->llen[ value ].info ); // Literal codon
       } else {
-         const uint16_t len_code = __len_code__( llen_pack[ idx ] );
-         const uint16_t len_nbit = __len_bits__( len_code );
-         zipfile.write( tree_llen[ len_code ].data, tree_llen[ len_code ].info ); // Length codon
-         if ( len_nbit > 0 ){
-            const uint16_t len_plus = llen_pack[ idx ] - __len_base__( len_code );
-            zipfile.write( len_plus, len_nbit ); // Shifts
-         }
-         const uint16_t dist_code = __dist_code__( dist_pack[ idx ] );
-         const uint16_t dist_nbit = bit_dist[ dist_code ];
-         zipfile.write( tree_dist[ dist_code ].data, tree_dist[ dist_code ].info ); // Dist codon
-         if ( dist_nbit > 0 ){
-            const uint16_t dist_plus = dist_pack[ idx ] - add_dist[ dist_code ];
-            zipfile.write( dist_plus, dist_nbit ); // Shifts
-         }
+         const zseb_code& len = encode->len[ lz77::token::len_shift( value ) ];
+         zipfile.write( len.data, len.size ); // Length codon and shifts
+         const uint16_t dist_shft = lz77::token::dist_shift( value );
+         const zseb_code& dist = encode->shift[ ( dist_shft < 256 ) ? dist_shft : ( 256 ^ ( dist_shft >> 7 ) ) ];
+         zipfile.write( dist.data ^ ( ( dist_shft & ( ( 1U << dist.plus ) - 1 ) ) << dist.size ), dist.size + dist.plus ); // Dist codon and shifts
       }
    }
-   zipfile.write( tree_llen[ ZSEB_LITLEN ].data, tree_llen[ ZSEB_LITLEN ].info ); // Stop codon
+
+}
+
+void zseb::huffman::stop(obstream& zipfile) const
+{
+   zipfile.write( encode->llen[ ZSEB_LITLEN ].data, encode->llen[ ZSEB_LITLEN ].info ); // Stop codon
+}
+
+uint32_t zseb::huffman::reuse_cost( const uint16_t * histogram ) const{
+
+   const uint16_t * stat_dist = histogram + ZSEB_HUF_LLEN;
+   uint32_t cost = 0;
+   for ( uint16_t cnt = 0; cnt < ZSEB_HUF_LLEN; cnt++ ){
+      if ( histogram[ cnt ] == 0 ){ continue; }
+      if ( encode->llen[ cnt ].info == 0 ){ return UINT32_MAX; }
+      cost += encode->llen[ cnt ].info * histogram[ cnt ];
+   }
+   for ( uint16_t cnt = 0; cnt < ZSEB_HUF_DIST; cnt++ ){
+      if ( stat_dist[ cnt ] == 0 ){ continue; }
+      if ( encode->dist[ cnt ].info == 0 ){ return UINT32_MAX; }
+      cost += encode->dist[ cnt ].info * stat_dist[ cnt ];
+   }
+   return cost;
+
+}
+
+double zseb::huffman::entropy( const uint16_t * histogram ){
+
+   double bits = 0.0;
+   for ( uint16_t part = 0; part < 2; part++ ){ // Literal/length, then distance symbols
+      const uint16_t * stat = histogram + ( ( part == 0 ) ? 0 : ZSEB_HUF_LLEN );
+      const uint16_t   size = ( ( part == 0 ) ? ZSEB_HUF_LLEN : ZSEB_HUF_DIST );
+      uint32_t total = 0;
+      for ( uint16_t cnt = 0; cnt < size; cnt++ ){ total += stat[ cnt ]; }
+      for ( uint16_t cnt = 0; cnt < size; cnt++ ){
+         if ( stat[ cnt ] != 0 ){ bits += stat[ cnt ] * log2( static_cast<double>( total ) / stat[ cnt ] ); }
+      }
+   }
+   return bits;
+
+}
+
+void zseb::huffman::__encode_tables__(){
+
+   // Symbols beyond HLIT or HDIST do not occur in the block
+   for ( uint16_t cnt = 0; cnt < ZSEB_HUF_LLEN; cnt++ ){ dynamic.llen[ cnt ] = tree_llen[ cnt ]; if ( cnt >= HLIT  ){ dynamic.llen[ cnt ].info = 0; } }
+   for ( uint16_t cnt = 0; cnt < ZSEB_HUF_DIST; cnt++ ){ dynamic.dist[ cnt ] = tree_dist[ cnt ]; if ( cnt >= HDIST ){ dynamic.dist[ cnt ].info = 0; } }
+   codes::merge( dynamic );
+   encode = &dynamic;
 
 }
 
@@ -357,9 +360,8 @@ uint16_t zseb::huffman::__get_sym__(ibstream& zipfile, zseb_node * tree)
     return idx;
 }
 
-void zseb::huffman::__CL_unpack__(ibstream& zipfile, zseb_node * tree, const uint16_t size, uint16_t * stat)
+bool zseb::huffman::__CL_unpack__(ibstream& zipfile, zseb_node * tree, const uint16_t size, uint16_t * stat)
 {
-    //uint32_t bit;
     uint16_t size_part = 0;
     uint16_t idx_sym;
 
@@ -371,32 +373,29 @@ void zseb::huffman::__CL_unpack__(ibstream& zipfile, zseb_node * tree, const uin
         {
             stat[size_part] = idx_sym;
             ++size_part;
+            continue;
         }
 
+        uint16_t bound = 0;
+        uint16_t item  = 0;
         if (idx_sym == 16)
         {
-            assert(size_part > 0);
-            uint16_t bound = size_part + static_cast<uint16_t>(3 + zipfile.read(2));
-            const uint16_t item = stat[size_part - 1];
-            for (; size_part < bound; ++size_part)
-                stat[size_part] = item;
-        }
-
-        if (idx_sym == 17)
-        {
-            uint16_t bound = size_part + static_cast<uint16_t>(3 + zipfile.read(3));
-            for (; size_part < bound; ++size_part)
-                stat[size_part] = 0;
-        }
-
-        if (idx_sym == 18)
-        {
-            uint16_t bound = size_part + static_cast<uint16_t>(11 + zipfile.read(7));
-            for (; size_part < bound; ++size_part)
-               stat[size_part] = 0;
+            if (size_part == 0)
+                return false; // Nothing to repeat
+            item  = stat[size_part - 1];
+            bound = size_part + static_cast<uint16_t>(3 + zipfile.read(2));
         }
+        else if (idx_sym == 17)
+            bound = size_part + static_cast<uint16_t>(3 + zipfile.read(3));
+        else
+            bound = size_part + static_cast<uint16_t>(11 + zipfile.read(7));
+
+        if (bound > size)
+            return false; // Repeat beyond HLIT + HDIST
+        for (; size_part < bound; ++size_part)
+            stat[size_part] = item;
     }
-    assert(size == size_part);
+    return true;
 }
 
 uint16_t zseb::huffman::__ssq_creation__( uint16_t * stat, const uint16_t size ){
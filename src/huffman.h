@@ -40,6 +40,37 @@
 
 namespace zseb{
 
+    // Why inflation of a DEFLATE stream failed
+    enum class inflate_error : uint8_t
+    {
+        none,
+        truncated,       // Input ended before the last block
+        block_type,      // BTYPE '11'_b
+        stored_length,   // NLEN != ~LEN
+        code_lengths,    // HLIT, HDIST, code length code or repeats out of range
+        literal_lengths, // Over-subscribed or incomplete literal/length code, or no stop codon
+        distances,       // Over-subscribed or incomplete distance code
+        symbol,          // Literal/length 286-287 or distance 30-31, or an unused bit sequence
+        distance         // Distance beyond the start of the output (and history)
+    };
+
+    inline const char * describe(const inflate_error error)
+    {
+        switch (error)
+        {
+            case inflate_error::none:            return "No error.";
+            case inflate_error::truncated:       return "Unexpected end of the compressed data.";
+            case inflate_error::block_type:      return "X11 is not a valid block mode.";
+            case inflate_error::stored_length:   return "Block type X00: NLEN != ( ~LEN )";
+            case inflate_error::code_lengths:    return "Invalid code lengths in block header.";
+            case inflate_error::literal_lengths: return "Over-subscribed or incomplete literal/length code.";
+            case inflate_error::distances:       return "Over-subscribed or incomplete distance code.";
+            case inflate_error::symbol:          return "Invalid literal/length or distance symbol.";
+            case inflate_error::distance:        return "Distance too far back.";
+        }
+        return "Unknown error.";
+    }
+
     struct zseb_node
     {
         uint16_t child[2];
@@ -47,6 +78,23 @@ namespace zseb{
         uint16_t info;       // parent OR bit length
     };
 
+    // Codon merged with its extra bits, for pack: write data ^ ( ( shift & mask( plus ) ) << size ) in size + plus bits
+    struct zseb_code
+    {
+        uint32_t data;       // Reversed codon, followed by its extra bits when these are known
+        uint8_t  size;       // Number of bits in data
+        uint8_t  plus;       // Number of extra bits still to take from the shift
+    };
+
+    // Everything pack needs for one block; the fixed trees have a constexpr instance (codes::fixed_encode)
+    struct zseb_encode
+    {
+        zseb_node llen[ ZSEB_HUF_LLEN ];  // Per symbol: { data, info } = { reversed codon, bit length }, 0 bits if unused
+        zseb_node dist[ ZSEB_HUF_DIST ];
+        zseb_code len[ 256 ];             // Per len_shift: length codon and extra bits
+        zseb_code shift[ 512 ];           // Per map_dist index: distance codon, with the extra bits below shift 256
+    };
+
    class huffman{
 
       public:
@@ -57,9 +105,9 @@ namespace zseb{
 
          /***  TREES  ***/
 
-         void load_tree(ibstream& zipfile);
+         inflate_error load_tree(ibstream& zipfile); // Validates the code lengths, so that unpack cannot loop on corrupt trees
 
-         void calc_tree( uint8_t * llen_pack, uint16_t * dist_pack, const uint32_t size );
+         void calc_tree( const uint16_t * histogram ); // ZSEB_HUF_COMBI frequencies: literal/length, then distance symbols
 
          void write_tree(obstream& zipfile) const;
 
@@ -67,9 +115,11 @@ namespace zseb{
 
          /***  (UN)PACK  ***/
 
-         void pack(obstream& zipfile, uint8_t * llen_pack, uint16_t * dist_pack, const uint32_t size);
+         void pack(obstream& zipfile, const uint32_t * tokens, const uint32_t size); // Packed tokens, see lz77::token
+
+         void stop(obstream& zipfile) const; // Stop codon: closes the block, so that consecutive packs may share a tree
 
-         void unpack(ibstream& zipfile, std::vector<uint8_t>& llen_pack, std::vector<uint16_t>& dist_pack);
+         bool unpack(ibstream& zipfile, std::vector<uint8_t>& llen_pack, std::vector<uint16_t>& dist_pack, const size_t limit = SIZE_MAX); // false if limit reached or invalid symbol
 
          /***  Get sizes of fixed / dynamic trees  ***/
 
@@ -77,19 +127,34 @@ namespace zseb{
 
          uint32_t get_size_X2() const{ return size_X2; }
 
+         uint32_t get_size_head() const{ return size_head; } // Bits of write_tree
+
+         /***  Tree reuse: codon bits, without extra bits or the stop codon  ***/
+
+         uint32_t reuse_cost( const uint16_t * histogram ) const; // With the current trees; UINT32_MAX if a symbol has no codon
+
+         static double entropy( const uint16_t * histogram ); // Lower bound for any tree
+
       private:
 
          /***  DATA: advantage of switching to data class, is that when buffers are too short, the trees are still in memory :-)  ***/
+         /***  Fixed-size members: one allocation with the owning object, no separate new[]  ***/
 
-         uint16_t * stat_comb; // Length ZSEB_HUF_COMBI: for stat_llen = stat_comb + 0 & stat_dist = stat_comb + HLIT
+         uint16_t stat_comb[ ZSEB_HUF_COMBI ]; // For stat_llen = stat_comb + 0 & stat_dist = stat_comb + HLIT
 
-         uint16_t * stat_ssq;  // Length ZSEB_HUF_SSQ
+         uint16_t stat_ssq[ ZSEB_HUF_SSQ ];
 
-         zseb_node * tree_llen; // Length ZSEB_HUF_TREE_LLEN
+         zseb_node tree_llen[ ZSEB_HUF_TREE_LLEN ];
 
-         zseb_node * tree_dist; // Length ZSEB_HUF_TREE_DIST
+         zseb_node tree_dist[ ZSEB_HUF_TREE_DIST ];
 
-         zseb_node * tree_ssq;  // Length ZSEB_HUF_TREE_SSQ
+         zseb_node tree_ssq[ ZSEB_HUF_TREE_SSQ ];
+
+         zseb_encode dynamic; // Encode tables of calc_tree
+
+         const zseb_encode * encode; // dynamic, or codes::fixed_encode after fixed_tree( 'O' )
+
+         bool fixed; // After fixed_tree( 'I' ): unpack decodes with the constexpr fixed tables
 
          uint16_t HLIT;
 
@@ -99,12 +164,14 @@ namespace zseb{
 
          uint16_t size_ssq;
 
-         bool * work; // Length ZSEB_HUF_TREE_LLEN; purely for combinations of zseb_node's in __build_tree__ modus 'I'
+         bool work[ ZSEB_HUF_TREE_LLEN ]; // Purely for combinations of zseb_node's in __build_tree__ modus 'I'
 
          uint32_t size_X1;
 
          uint32_t size_X2;
 
+         uint32_t size_head;
+
          /***  HELPER FUNCTIONS  ***/
 
          static inline uint16_t __bit_reverse__( uint16_t code, const uint16_t nbits );
@@ -113,37 +180,25 @@ namespace zseb{
 
          static void __build_tree__( uint16_t * stat, const uint16_t size, zseb_node * tree, bool * temp, const char option, const uint16_t ZSEB_MAX_BITS );
 
-         static uint16_t __ssq_creation__( uint16_t * stat, const uint16_t size );
-
-         static void __CL_unpack__(ibstream& zipfile, zseb_node * tree, const uint16_t size, uint16_t * stat);
-
-         static uint16_t __get_sym__(ibstream& zipfile, zseb_node * tree);
+         void __encode_tables__();
 
-         /***  HUFFMAN TREE STATIC CONSTANTS  ***/
+         template<bool FIXED> bool __unpack__(ibstream& zipfile, std::vector<uint8_t>& llen_pack, std::vector<uint16_t>& dist_pack, const size_t limit);
 
-         static const uint8_t map_len[ 256 ];  // code_length = 257 + map_len[ len_shift ]; ( len_shift = length - 3 )
+         static uint16_t __ssq_creation__( uint16_t * stat, const uint16_t size );
 
-         static const uint8_t bit_len[ 29 ];   // bits_length =       bit_len[ code_length - 257 ];
+         static bool __valid_code__( const uint16_t * stat, const uint16_t size, const uint16_t ZSEB_MAX_BITS, const bool degenerate );
 
-         static const uint8_t add_len[ 29 ];   // base_length =   3 + add_len[ code_length - 257 ];
+         static bool __degenerate_tree__( const uint16_t * stat, const uint16_t size, zseb_node * tree );
 
-         static const uint8_t map_dist[ 512 ]; // code_distance = ( shift < 256 ) ? map_dist[ shift ] : map_dist[ 256 ^ ( shift >> 7 ) ]; ( shift = dist - 1 )
+         static bool __CL_unpack__(ibstream& zipfile, zseb_node * tree, const uint16_t size, uint16_t * stat);
 
-         static const uint8_t bit_dist[ 30 ];  // bits_distance =     bit_dist[ code_distance ];
+         static uint16_t __get_sym__(ibstream& zipfile, zseb_node * tree);
 
-         static const uint16_t add_dist[ 30 ];  // base_distance = 1 + add_dist[ code_distance ];
+         /***  HUFFMAN TREE STATIC CONSTANTS  ***/
 
          static const uint8_t map_ssq[ 19 ];
 
-         /***  CONVERSIONS  ***/
-
-         static inline uint16_t  __len_code__( const uint8_t  len_shft ); // [ 257 : 285 ]
-
-         static inline uint8_t  __len_bits__( const uint16_t  len_code ); // [ 0 : 5 ]
-
-         static inline uint8_t  __len_base__( const uint16_t  len_code ); // [ 0 : 255 ]
-
-         static inline uint8_t __dist_code__( const uint16_t dist_shft ); // [ 0 :  29 ]
+         friend struct huffman_kernels; // zseb-micro times the private tree helpers in isolation
 
    };
 
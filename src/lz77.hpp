@@ -21,11 +21,16 @@
 
 #include <stdint.h>  // uint{8,16,32,64}_t
 #include <limits.h>  // CHAR_BIT
+#include <assert.h>  // assert
 #include <utility>   // std::pair
 #include <algorithm> // std::min
 #include <tuple>     // std::tuple
+#include <array>
 #include <vector>
 
+#include "symbols.hpp"
+#include "stats.hpp"
+
 namespace zseb
 {
 namespace lz77
@@ -44,24 +49,137 @@ constexpr const uint32_t HASH_STOP = 0;
 constexpr const uint32_t TOO_FAR   = 4096; // Discard matches of length LEN_SHIFT if further than TOO_FAR
 
 
-constexpr std::pair<uint32_t, uint16_t> match(const char * window, const uint32_t current, const uint32_t runway, const std::array<uint32_t, HIST_SIZE>& prev) noexcept
+// Hash chains of one thread. Positions are stored as base + pos, so that entries below base are stale:
+// new data only advances base (or carry moves it along with the window), and the tables are cleared only when base would overflow.
+struct chains
+{
+    std::array<uint32_t, HIST_SIZE> prev;
+    std::array<uint32_t, HASH_SIZE> head;
+    uint32_t base;
+    uint32_t used;   // Window positions seen since base was set: all entries lie below base + used
+    uint32_t hashed; // Window positions below hashed are in the tables; deflate leaves the last ones to resume
+
+    chains() noexcept { clear(); }
+
+    void clear() noexcept
+    {
+        prev.fill(HASH_STOP);
+        head.fill(HASH_STOP);
+        base = 0;
+        used = 0;
+        hashed = 0;
+    }
+
+    // Invalidate all entries; base remains a multiple of HIST_SIZE, so that pos & HIST_MASK is unaffected.
+    // Clearing once base exceeds 2^31 leaves 2 GiB for the positions of the next window.
+    void advance() noexcept
+    {
+        const uint64_t next = (static_cast<uint64_t>(base) + used + HIST_MASK) & ~static_cast<uint64_t>(HIST_MASK);
+        if (next > (UINT32_MAX >> 1))
+            clear();
+        else
+            base = static_cast<uint32_t>(next);
+        used = 0;
+        hashed = 0;
+    }
+
+    // Keep the entries for a window which starts shift bytes later in the data, when its history window[0:start]
+    // is exactly the data hashed so far, so that deflate can skip prepare. False if not possible: deflate then advances.
+    bool carry(const uint64_t shift, const uint32_t start) noexcept
+    {
+        if ((shift % HIST_SIZE != 0) || (shift + start != used) || (shift > hashed) || (base + shift > (UINT32_MAX >> 1)))
+            return false;
+        base  += static_cast<uint32_t>(shift);
+        used   = start;
+        hashed = static_cast<uint32_t>(hashed - shift);
+        return true;
+    }
+};
+
+
+// Packed token: a literal is its byte (below 256). A pair sets bit 8, with the length shift in bits 9-16 and the
+// distance shift in bits 17-31, so that huffman::pack can index its per-block encode tables without decoding symbols.
+namespace token
+{
+
+constexpr uint32_t PAIR = 0x100U;
+
+constexpr uint32_t literal(const uint8_t lit) noexcept
+{
+    return lit;
+}
+
+constexpr uint32_t pair(const uint8_t len_shift, const uint16_t dist_shift) noexcept
+{
+    return PAIR ^ (static_cast<uint32_t>(len_shift) << 9) ^ (static_cast<uint32_t>(dist_shift) << 17);
+}
+
+constexpr bool     is_pair   (const uint32_t value) noexcept { return (value & PAIR) != 0; }
+constexpr uint8_t  len_shift (const uint32_t value) noexcept { return (value >> 9) & 0xffU; }
+constexpr uint16_t dist_shift(const uint32_t value) noexcept { return value >> 17; }
+
+constexpr uint16_t llen_code(const uint32_t value) noexcept { return is_pair(value) ? symbols::len_code(len_shift(value)) : value; }
+constexpr uint8_t  dist_code(const uint32_t value) noexcept { return symbols::dist_code(dist_shift(value)); }
+
+} // End of namespace token
+
+
+constexpr const uint32_t SEGMENT = 4096; // Tokens per histogram: the granularity of block boundaries
+
+// Histogram of the symbols of at most SEGMENT consecutive tokens (the stop codon is not included)
+struct segment
+{
+    uint32_t size;
+    uint16_t stat[symbols::NUM_LLEN + symbols::NUM_DIST]; // Literal/length symbols, followed by distance symbols
+};
+
+// Output of deflate: packed tokens in storage owned by the caller, with room for one token per input byte,
+// and the histograms of consecutive segments of these tokens, so that the Huffman stage needs no statistics pass
+struct tokens
+{
+    uint32_t * store;
+    uint32_t   size;
+    std::vector<segment> * segments;
+
+    void push(const uint32_t value) noexcept
+    {
+        if ((segments->size() == 0) || (segments->back().size == SEGMENT))
+        {
+            segments->emplace_back();
+            segment& item = segments->back();
+            item.size = 0;
+            std::fill(item.stat, item.stat + symbols::NUM_LLEN + symbols::NUM_DIST, 0);
+        }
+        segment& item = segments->back();
+        item.size += 1;
+        item.stat[token::llen_code(value)] += 1;
+        if (token::is_pair(value)){ item.stat[symbols::NUM_LLEN + token::dist_code(value)] += 1; }
+        store[size++] = value;
+    }
+};
+
+
+// Returns the match position relative to window, or HASH_STOP
+constexpr std::pair<uint32_t, uint16_t> match(const char * window, const uint32_t current, const uint32_t runway, const std::array<uint32_t, HIST_SIZE>& prev, const uint32_t base) noexcept
 {
     const uint16_t max_len = std::min(MAX_MATCH, runway);
     if (max_len < LEN_SHIFT)
         return { HASH_STOP, 1 };
+    ZSEB_COUNT(match_calls, 1);
 
     const char * cutoff = window + current + max_len;
 
     uint32_t result_ptr = HASH_STOP;
     uint16_t result_len = 1;
 
-    const uint32_t ptr_lim = current > HIST_SIZE ? current - HIST_SIZE : 0;
+    const uint32_t ptr_lim = base + (current > HIST_SIZE ? current - HIST_SIZE : 0); // Also rejects stale entries
     uint32_t ptr = prev[current & HIST_MASK]; // ptr == current & HIST_SIZE implies ptr = current - HIST_SIZE <= ptr_lim
 
     while (ptr > ptr_lim)
     {
+        ZSEB_COUNT(chain_steps, 1);
         const char * present = window + current;
-        const char * history = window + ptr;
+        const char * history = window + (ptr - base);
 
         // If hash_key equal and first two characters equal --> third must be equal as well
         if ((history[0] != present[0]) ||
@@ -87,7 +205,7 @@ constexpr std::pair<uint32_t, uint16_t> match(const char * window, const uint32_
         if (length > result_len)
         {
             result_len = length;
-            result_ptr = ptr;
+            result_ptr = ptr - base;
             if (result_len == max_len)
                 break;
         }
@@ -107,12 +225,11 @@ constexpr uint32_t update(const uint32_t key, const char next) noexcept
 }
 
 
-inline uint32_t prepare(const char * window, const uint32_t start, const uint32_t end, std::array<uint32_t, HIST_SIZE>& prev, std::array<uint32_t, HASH_SIZE>& head) noexcept
+// Hash the history window[0:start]; the tables need no clearing, as entries below table.base are stale
+inline uint32_t prepare(const char * window, const uint32_t start, const uint32_t end, chains& table) noexcept
 {
-    for (uint32_t cnt = 0; cnt < HIST_SIZE; ++cnt) { prev[cnt] = HASH_STOP; }
-    for (uint32_t cnt = 0; cnt < HASH_SIZE; ++cnt) { head[cnt] = HASH_STOP; }
-
     uint32_t key = 0;
+    table.advance();
     if (start + LEN_SHIFT <= end)
     {
         key = update(0,   window[0]);
@@ -122,8 +239,8 @@ inline uint32_t prepare(const char * window, const uint32_t start, const uint32_
         assert(start <= HIST_SIZE);
         for (uint32_t cnt = 0; cnt < start; ++cnt)
         {
-            prev[cnt] = head[key];
-            head[key] = cnt;
+            table.prev[cnt] = table.head[key];
+            table.head[key] = table.base + cnt;
             key = update(key, window[cnt + 3]);
         }
     }
@@ -131,13 +248,32 @@ inline uint32_t prepare(const char * window, const uint32_t start, const uint32_
 }
 
 
+// For tables that already hold the history (see chains::carry): hash the positions which the previous deflate left,
+// now that the data which follows them is known, so that the tables equal those of prepare. Returns the key of start.
+inline uint32_t resume(const char * window, const uint32_t start, const uint32_t end, chains& table) noexcept
+{
+    uint32_t key = update(update(update(0, window[table.hashed]), window[table.hashed + 1]), window[table.hashed + 2]);
+    for (uint32_t cnt = table.hashed; cnt < start; ++cnt)
+    {
+        table.prev[cnt & HIST_MASK] = table.head[key];
+        table.head[key] = table.base + cnt;
+        key = update(key, window[cnt + 3]);
+    }
+    return start + LEN_SHIFT <= end ? key : 0;
+}
+
+
+// With carried, table holds the history window[0:current] already (see chains::carry)
 inline uint32_t deflate(const char * window, uint32_t current, const uint32_t end,
-    std::array<uint32_t, HIST_SIZE>& prev,
-    std::array<uint32_t, HASH_SIZE>& head,
-    std::vector<uint8_t>&  llen_pack,
-    std::vector<uint16_t>& dist_pack) noexcept
+    chains& table,
+    tokens& output,
+    const bool carried = false) noexcept
 {
-    uint32_t key = prepare(window, current, end, prev, head);
+    uint32_t key = carried ? resume(window, current, end, table) : prepare(window, current, end, table);
+    std::array<uint32_t, HIST_SIZE>& prev = table.prev;
+    std::array<uint32_t, HASH_SIZE>& head = table.head;
+    const uint32_t base = table.base;
+    const uint32_t first = current;
     uint32_t lzss = 0;
 
     uint32_t now_ptr = HASH_STOP;
@@ -155,47 +291,61 @@ inline uint32_t deflate(const char * window, uint32_t current, const uint32_t en
         else
         {
             prev[current & HIST_MASK] = head[key];
-            std::tie(now_ptr, now_len) = match(window, current, end - current, prev); // End - current: do not peek beyond current frame!
+            std::tie(now_ptr, now_len) = match(window, current, end - current, prev, base); // End - current: do not peek beyond current frame!
         }
 
         prev[current & HIST_MASK] = head[key];
-        head[key] = current;
+        head[key] = base + current;
         key = update(key, window[current + 3]);
         ++current;
         prev[current & HIST_MASK] = head[key];
-        std::tie(nxt_ptr, nxt_len) = match(window, current, end - current, prev); // End - current: do not peek beyond current frame!
+        std::tie(nxt_ptr, nxt_len) = match(window, current, end - current, prev, base); // End - current: do not peek beyond current frame!
 
         if ((now_ptr == HASH_STOP) || (nxt_len > now_len))
         {
             lzss += CHAR_BIT + 1;
-            llen_pack.push_back(static_cast<uint8_t>(window[current - 1]));
-            dist_pack.push_back(UINT16_MAX);
+            ZSEB_COUNT(literals, 1);
+            output.push(token::literal(static_cast<uint8_t>(window[current - 1])));
             now_len = 1;
         }
         else
         {
             lzss += HIST_BITS + CHAR_BIT + 1;
-            llen_pack.push_back(static_cast<uint8_t>(now_len - LEN_SHIFT));
-            dist_pack.push_back(static_cast<uint16_t>(current - (1 + now_ptr + DIS_SHIFT)));
+            ZSEB_COUNT(matches, 1);
+            output.push(token::pair(static_cast<uint8_t>(now_len - LEN_SHIFT), static_cast<uint16_t>(current - (1 + now_ptr + DIS_SHIFT))));
         }
 
         for (uint16_t cnt = 1; cnt < now_len; ++cnt)
         {
             prev[current & HIST_MASK] = head[key];
-            head[key] = current;
+            head[key] = base + current;
             key = update(key, window[current + 3]);
             ++current;
         }
     }
+
+    // The last two positions were keyed with the lookahead past end: take them off their chains (they are the most
+    // recent entries), so that resume can hash them with the data which follows. Without a key (tiny batch) keep all.
+    const uint32_t keep = first + LEN_SHIFT <= end ? end - (LEN_SHIFT - 1) : end;
+    for (uint32_t pos = end; pos > keep; --pos)
+    {
+        const uint32_t stale = update(update(update(0, window[pos - 1]), window[pos]), window[pos + 1]);
+        head[stale] = prev[(pos - 1) & HIST_MASK];
+    }
+    table.used = end;
+    table.hashed = keep;
     return lzss;
 }
 
 
-inline uint64_t inflate(std::vector<char>& frame, const uint8_t llen_code, const uint16_t dist_code) noexcept
+// Frame elements are char, or wider types to carry placeholders for unknown history (see speculate.cpp).
+// Unchecked: the caller guarantees that the distance does not exceed frame.size() (see decompressor::step)
+template <typename T>
+inline uint64_t inflate(std::vector<T>& frame, const uint8_t llen_code, const uint16_t dist_code) noexcept
 {
     if (dist_code == UINT16_MAX)
     {
-        frame.push_back(static_cast<char>(llen_code));
+        frame.push_back(static_cast<T>(llen_code));
         return CHAR_BIT + 1;
     }
     else
@@ -20,11 +20,17 @@
 #define ZSEB_VERSION   "UNRELEASED" //"0.9.6"
 
 #include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <fstream>
 #include <iostream>
 #include <thread>
 
 #include "dtypes.h"
 #include "zseb.h"
+#include "stats.hpp"
+#include "affinity.hpp"
+#include "ring.hpp"
 
 void print_help(){
 
@@ -35,8 +41,8 @@ std::cout << "\n"
 "Usage: zseb [OPTIONS]\n"
 "\n"
 "    INFO\n"
-"        zseb is a GZIP/DEFLATE implementation compatible with\n"
-"        RFC 1951 and RFC 1952.\n"
+"        zseb is a GZIP/ZLIB/DEFLATE implementation compatible with\n"
+"        RFC 1950, RFC 1951 and RFC 1952.\n"
 "\n"
 "    ARGUMENTS\n"
 "        -z, --zip=infile\n"
@@ -45,17 +51,85 @@ std::cout << "\n"
 "        -u, --unzip=infile\n"
 "                Unzip infile.\n"
 "\n"
+"        -i, --index=infile\n"
+"                Build a random-access index of infile.\n"
+"\n"
+"        -e, --extract=infile\n"
+"                Extract the range -r of infile with its index -x.\n"
+"\n"
+"        -T, --train=samples\n"
+"                Train a dictionary on the files in directory samples,\n"
+"                or on the files listed in file samples.\n"
+"\n"
+"        -E, --estimate=infile\n"
+"                Predict the size of the zipped infile from a sample of\n"
+"                infile, without writing any output: within 2% of zip\n"
+"                on uniform data, 10% on mixed data.\n"
+"\n"
 "        -o, --output=outfile\n"
 "                Output to outfile.\n"
 "\n"
 "        -n, --name\n"
-"                Use or restore name.\n"
+"                Use or restore name (restore requires gzip format).\n"
+"\n"
+"        -f, --format=container\n"
+"                Container: gzip, zlib or raw (default = gzip).\n"
 "\n"
 "        -p, --print\n"
 "                Print compression and timing.\n"
 "\n"
+"        --stats=file\n"
+"                Write per-stage times and counters of -z or -u to file\n"
+"                as JSON (requires a build with -DZSEB_STATS).\n"
+"\n"
+"        --trace=file\n"
+"                Write the stages of -z or -u per thread to file as a\n"
+"                Chrome trace (requires a build with -DZSEB_STATS).\n"
+"\n"
+"        -s, --span=MiB\n"
+"                Distance between index access points (default = 1).\n"
+"\n"
+"        -x, --indexfile=file\n"
+"                Index used by -e (default = infile.zsi).\n"
+"\n"
+"        -r, --range=offset:length\n"
+"                Uncompressed byte range extracted by -e.\n"
+"\n"
+"        -d, --dictionary=file\n"
+"                Preset dictionary for -z and -u; the last 32 KiB serve\n"
+"                as history. Stored as DICTID in the zlib format.\n"
+"\n"
+"        -D, --dictsize=bytes\n"
+"                Size of the dictionary trained by -T (default = 32768).\n"
+"\n"
+"        -b, --batch\n"
+"                With -z or -u: infile is a directory, or a file which\n"
+"                lists one file per line. These files are zipped to\n"
+"                file.gz (.zz, .deflate) or unzipped by -t workers with\n"
+"                reused contexts; gzip files over 4 MiB are zipped in\n"
+"                parts, as members with their size in FEXTRA, which\n"
+"                unzip inflates concurrently.\n"
+"\n"
+"        -S, --speculate\n"
+"                Experimental: unzip a single member on -t threads by\n"
+"                speculating on block boundaries.\n"
+"\n"
 "        -t, --threads\n"
-"                Number of threads (default = hardware concurrency).\n"
+"                Number of threads, or auto (default): the CPUs of the\n"
+"                affinity mask and cgroup CPU quota. Zip uses no more\n"
+"                threads than 128 KiB batches, and one for tiny inputs.\n"
+"                Unzip decompresses members with a size hint (BGZF or\n"
+"                zip -b) concurrently.\n"
+"\n"
+"        -a, --affinity\n"
+"                Pin the zip workers to the allowed CPUs, allocate their\n"
+"                hash chains on their own NUMA node and interleave the\n"
+"                shared frame over the NUMA nodes.\n"
+"\n"
+"        --uring\n"
+"                Read the input of -z and write the output of -z and -u\n"
+"                with io_uring, 4 requests of 1 MiB in flight (blocking\n"
+"                pread and pwrite if io_uring is unavailable).\n"
 "\n"
 "        -v, --version\n"
 "                Print the version.\n"
@@ -75,24 +149,52 @@ int main(int argc, char ** argv)
     bool outset = false;
     bool name = false;
     bool print = false;
-    int num_threads = std::thread::hardware_concurrency();
+    bool speculative = false;
+    bool batch = false;
+    zseb::zseb_format format = zseb::zseb_format::gzip;
+    int num_threads = 0; // auto
+    uint64_t span = 1;
+    std::string indexfile;
+    uint64_t range_offset = 0;
+    uint64_t range_length = 0;
+    bool range_set = false;
+    std::string dictfile;
+    uint32_t dictsize = 32768;
+    std::string statsfile;
+    std::string tracefile;
 
     struct option long_options[] =
     {
-        {"zip",     required_argument, 0, 'z'},
-        {"unzip",   required_argument, 0, 'u'},
-        {"output",  required_argument, 0, 'o'},
-        {"threads", required_argument, 0, 't'},
-        {"name",    no_argument,       0, 'n'},
-        {"print",   no_argument,       0, 'p'},
-        {"version", no_argument,       0, 'v'},
-        {"help",    no_argument,       0, 'h'},
+        {"zip",         required_argument, 0, 'z'},
+        {"unzip",       required_argument, 0, 'u'},
+        {"index",       required_argument, 0, 'i'},
+        {"extract",     required_argument, 0, 'e'},
+        {"span",        required_argument, 0, 's'},
+        {"indexfile",   required_argument, 0, 'x'},
+        {"range",       required_argument, 0, 'r'},
+        {"train",       required_argument, 0, 'T'},
+        {"estimate",    required_argument, 0, 'E'},
+        {"dictionary",  required_argument, 0, 'd'},
+        {"dictsize",    required_argument, 0, 'D'},
+        {"output",      required_argument, 0, 'o'},
+        {"threads",     required_argument, 0, 't'},
+        {"affinity",    no_argument,       0, 'a'},
+        {"uring",       no_argument,       0, 'R'},
+        {"format",      required_argument, 0, 'f'},
+        {"name",        no_argument,       0, 'n'},
+        {"print",       no_argument,       0, 'p'},
+        {"speculate",   no_argument,       0, 'S'},
+        {"batch",       no_argument,       0, 'b'},
+        {"stats",       required_argument, 0, 'J'},
+        {"trace",       required_argument, 0, 'K'},
+        {"version",     no_argument,       0, 'v'},
+        {"help",        no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
     int option_index = 0;
     int c;
-    while ((c = getopt_long(argc, argv, "hvz:u:o:npt:", long_options, &option_index)) != -1)
+    while ((c = getopt_long(argc, argv, "hvz:u:i:e:T:E:s:x:r:d:D:o:npSbat:f:", long_options, &option_index)) != -1)
     {
         switch(c)
         {
@@ -113,6 +215,37 @@ int main(int argc, char ** argv)
                 infile = optarg;
                 modus = zseb::zseb_modus::unzip;
                 break;
+            case 'i':
+                infile = optarg;
+                modus = zseb::zseb_modus::index;
+                break;
+            case 'e':
+                infile = optarg;
+                modus = zseb::zseb_modus::extract;
+                break;
+            case 'T':
+                infile = optarg;
+                modus = zseb::zseb_modus::train;
+                break;
+            case 'E':
+                infile = optarg;
+                modus = zseb::zseb_modus::estimate;
+                break;
+            case 'd':
+                dictfile = optarg;
+                break;
+            case 'D':
+                dictsize = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                span = strtoull(optarg, NULL, 10);
+                break;
+            case 'x':
+                indexfile = optarg;
+                break;
+            case 'r':
+                range_set = sscanf(optarg, "%" SCNu64 ":%" SCNu64, &range_offset, &range_length) == 2;
+                break;
             case 'o':
                 outfile = optarg;
                 outset = true;
@@ -123,43 +256,165 @@ int main(int argc, char ** argv)
             case 'p':
                 print = true;
                 break;
+            case 'S':
+                speculative = true;
+                break;
+            case 'b':
+                batch = true;
+                break;
+            case 'J':
+                statsfile = optarg;
+                break;
+            case 'K':
+                tracefile = optarg;
+                break;
             case 't':
-                num_threads = atoi(optarg);
+                num_threads = std::string(optarg) == "auto" ? 0 : (atoi(optarg) > 0 ? atoi(optarg) : -1);
+                break;
+            case 'a':
+                zseb::affinity::enable();
+                break;
+            case 'R':
+                zseb::ring::enable();
+                break;
+            case 'f':
+                if      (std::string(optarg) == "gzip"){ format = zseb::zseb_format::gzip; }
+                else if (std::string(optarg) == "zlib"){ format = zseb::zseb_format::zlib; }
+                else if (std::string(optarg) ==  "raw"){ format = zseb::zseb_format::raw;  }
+                else
+                {
+                    std::cerr << "zseb: option -f must be gzip, zlib or raw" << std::endl;
+                    print_help();
+                    return 0;
+                }
                 break;
         }
     }
 
     if (modus == zseb::zseb_modus::undefined)
     {
-        std::cerr << "zseb: option -z or -u must be specified" << std::endl;
+        std::cerr << "zseb: option -z, -u, -i, -e, -T or -E must be specified" << std::endl;
         print_help();
         return 0;
     }
 
-    if ((!outset) && (!name))
+    if (batch && (modus != zseb::zseb_modus::zip) && (modus != zseb::zseb_modus::unzip))
+    {
+        std::cerr << "zseb: option -b requires option -z or -u" << std::endl;
+        print_help();
+        return 0;
+    }
+
+    if ((!outset) && (!name) && (!batch) && (modus != zseb::zseb_modus::estimate))
     {
         std::cerr << "zseb: option -o or -n must be specified" << std::endl;
         print_help();
         return 0;
     }
 
-    if ((num_threads <= 0) || (static_cast<uint32_t>(num_threads) > std::thread::hardware_concurrency()))
+    if ((modus == zseb::zseb_modus::extract) && ((!outset) || (!range_set)))
+    {
+        std::cerr << "zseb: option -e requires options -o and -r" << std::endl;
+        print_help();
+        return 0;
+    }
+
+    if ((modus == zseb::zseb_modus::train) && (!outset))
+    {
+        std::cerr << "zseb: option -T requires option -o" << std::endl;
+        print_help();
+        return 0;
+    }
+
+    if ((!dictfile.empty()) && (format == zseb::zseb_format::gzip))
     {
-        std::cerr << "zseb: option -t must be positive and at most std::thread::hardware_concurrency() = " << std::thread::hardware_concurrency() << std::endl;
+        std::cerr << "zseb: option -d requires the zlib or raw format" << std::endl;
         print_help();
         return 0;
     }
 
-    if (modus == zseb::zseb_modus::zip)
+    if ((modus == zseb::zseb_modus::index) && (span == 0))
     {
-        if (name){ outfile = infile + ".gz"; }
-        zseb::tools::zip(/*flate, zipfile,*/infile, outfile, print, static_cast<uint32_t>(num_threads));
+        std::cerr << "zseb: option -s must be positive" << std::endl;
+        print_help();
+        return 0;
     }
 
-    if (modus == zseb::zseb_modus::unzip)
+    if ((modus == zseb::zseb_modus::unzip) && name && (!batch) && (format != zseb::zseb_format::gzip))
     {
-        zseb::tools::unzip(/*flate, zipfile,*/infile, outfile, name, print);
+        std::cerr << "zseb: option -n can only restore the name from the gzip format" << std::endl;
+        print_help();
+        return 0;
+    }
 
+    if ((num_threads < 0) || (static_cast<uint32_t>(num_threads) > std::thread::hardware_concurrency()))
+    {
+        std::cerr << "zseb: option -t must be auto, or positive and at most std::thread::hardware_concurrency() = " << std::thread::hardware_concurrency() << std::endl;
+        print_help();
+        return 0;
+    }
+    if (num_threads == 0){ num_threads = static_cast<int>(zseb::affinity::available()); }
+
+    if (((!statsfile.empty()) || (!tracefile.empty())) && (!ZSEB_STATS_ENABLED))
+    {
+        std::cerr << "zseb: options --stats and --trace require a build with -DZSEB_STATS" << std::endl;
+        return 255;
+    }
+    if (!tracefile.empty()){ zseb::trace::global().active = true; }
+
+    std::vector<char> dictionary;
+    if (!dictfile.empty()){ dictionary = zseb::tools::load_dictionary(dictfile); }
+
+    if ((modus == zseb::zseb_modus::zip) && batch)
+        zseb::tools::zip_batch(infile, print, static_cast<uint32_t>(num_threads), format, dictionary);
+
+    if ((modus == zseb::zseb_modus::unzip) && batch)
+        zseb::tools::unzip_batch(infile, print, format, static_cast<uint32_t>(num_threads), dictionary);
+
+    if ((modus == zseb::zseb_modus::zip) && (!batch))
+    {
+        if (name){ outfile = infile + (format == zseb::zseb_format::gzip ? ".gz" : (format == zseb::zseb_format::zlib ? ".zz" : ".deflate")); }
+        zseb::tools::zip(/*flate, zipfile,*/infile, outfile, print, static_cast<uint32_t>(num_threads), format, dictionary);
+    }
+
+    if ((modus == zseb::zseb_modus::unzip) && (!batch))
+    {
+        zseb::tools::unzip(/*flate, zipfile,*/infile, outfile, name, print, format, static_cast<uint32_t>(num_threads), speculative, dictionary);
+
+    }
+
+    if (modus == zseb::zseb_modus::index)
+    {
+        if (name){ outfile = infile + ".zsi"; }
+        zseb::tools::index(infile, outfile, span << 20, print, format);
+    }
+
+    if (modus == zseb::zseb_modus::extract)
+    {
+        if (indexfile.empty()){ indexfile = infile + ".zsi"; }
+        zseb::tools::extract(infile, indexfile, outfile, range_offset, range_length);
+    }
+
+    if (modus == zseb::zseb_modus::train)
+    {
+        zseb::tools::train(infile, outfile, dictsize, print);
+    }
+
+    if (modus == zseb::zseb_modus::estimate)
+    {
+        zseb::tools::estimate(infile, print, format, dictionary);
+    }
+
+    if (!statsfile.empty())
+    {
+        std::ofstream report(statsfile.c_str());
+        zseb::stats::report(report, static_cast<uint32_t>(num_threads));
+    }
+
+    if (!tracefile.empty())
+    {
+        std::ofstream report(tracefile.c_str());
+        zseb::trace::dump(report, zseb::stats::timer_names);
     }
 
     return 0;
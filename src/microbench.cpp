@@ -0,0 +1,434 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+// zseb-micro: isolated timings of the kernels, per byte or per symbol, with hardware counters where available
+
+#include <getopt.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dtypes.h"
+#include "lz77.hpp"
+#include "crc32.hpp"
+#include "adler32.hpp"
+#include "huffman.h"
+#include "bitstream.hpp"
+#include "compressor.h"
+#include "pages.hpp"
+
+namespace zseb
+{
+
+// Access to the private static tree helpers of huffman
+struct huffman_kernels
+{
+    static uint16_t prefix_lengths(uint16_t * stat, const uint16_t size, zseb_node * tree, bool * temp)
+    {
+        return huffman::__prefix_lengths__(stat, size, tree, temp, ZSEB_MAX_BITS_LLD);
+    }
+
+    static void build_tree(uint16_t * stat, const uint16_t size, zseb_node * tree, bool * temp, const char option)
+    {
+        huffman::__build_tree__(stat, size, tree, temp, option, ZSEB_MAX_BITS_LLD);
+    }
+};
+
+}
+
+namespace
+{
+
+constexpr const uint32_t WINDOW = zseb::BATCH_SIZE; // Bytes deflated per run, after HIST_SIZE bytes of history
+constexpr const uint32_t NUM_BITS = 1U << 20;       // (value, nbits) pairs for the bit I/O kernels
+constexpr const uint32_t CRC_SIZE = 1U << 22;
+
+volatile uint64_t sink; // Keeps results alive
+
+
+// Cycles, branch misses, cache misses and dTLB load misses of this thread as one perf_event_open group; inert without
+// permission, and without the last column if the CPU has no dTLB event
+class counters
+{
+    public:
+
+        counters() : leader(-1), opened(0)
+        {
+            std::fill(fds, fds + NUM, -1);
+            const uint32_t types[NUM]   = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE };
+            const uint64_t configs[NUM] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES,
+                PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) };
+            for (uint32_t idx = 0; idx < NUM; ++idx)
+            {
+                struct perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size           = sizeof(attr);
+                attr.type           = types[idx];
+                attr.config         = configs[idx];
+                attr.disabled       = (idx == 0) ? 1 : 0;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv     = 1;
+                attr.read_format    = PERF_FORMAT_GROUP;
+                fds[idx] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+                if ((fds[idx] < 0) && (idx == NUM - 1))
+                    break;
+                if (fds[idx] < 0)
+                {
+                    close_all();
+                    return;
+                }
+                if (idx == 0){ leader = fds[0]; }
+                opened = idx + 1;
+            }
+        }
+
+        ~counters(){ close_all(); }
+
+        bool available() const{ return leader >= 0; }
+
+        // Events counted: the dTLB column is empty if this is NUM - 1
+        uint32_t events() const{ return opened; }
+
+        void start()
+        {
+            if (!available()){ return; }
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+
+        // Counts of the events since start
+        std::vector<uint64_t> stop()
+        {
+            std::vector<uint64_t> values(NUM, 0);
+            if (!available()){ return values; }
+            ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            uint64_t group[1 + NUM];
+            const ssize_t size = static_cast<ssize_t>((1 + opened) * sizeof(uint64_t));
+            if (read(leader, group, size) == size)
+                std::copy(group + 1, group + 1 + opened, values.begin());
+            return values;
+        }
+
+        static constexpr const uint32_t NUM = 4;
+
+    private:
+
+        int fds[NUM];
+
+        int leader;
+
+        uint32_t opened;
+
+        void close_all()
+        {
+            for (uint32_t idx = 0; idx < NUM; ++idx){ if (fds[idx] >= 0){ close(fds[idx]); fds[idx] = -1; } }
+            leader = -1;
+            opened = 0;
+        }
+};
+
+
+// Run kernel repeats times; units is the number of bytes or symbols it processes per run
+void measure(counters& perf, const std::string& name, const char * unit, const uint64_t units, const uint32_t repeats, const std::function<void()>& kernel)
+{
+    kernel(); // Warm up caches and branch predictors
+    std::vector<double> nanos;
+    perf.start();
+    for (uint32_t run = 0; run < repeats; ++run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        kernel();
+        auto end = std::chrono::steady_clock::now();
+        nanos.push_back(std::chrono::duration<double, std::nano>(end - start).count() / units);
+    }
+    const std::vector<uint64_t> events = perf.stop();
+    std::sort(nanos.begin(), nanos.end());
+
+    std::cout << name << "," << unit << "," << units << "," << repeats << "," << nanos.front() << "," << nanos[nanos.size() / 2];
+    for (uint32_t idx = 0; idx < counters::NUM; ++idx)
+    {
+        if (idx < perf.events())
+            std::cout << "," << static_cast<double>(events[idx]) / (static_cast<double>(units) * repeats);
+        else
+            std::cout << ",";
+    }
+    std::cout << std::endl;
+}
+
+
+void print_help()
+{
+std::cout << "\n"
+"zseb-micro: isolated timings of the zseb kernels\n"
+"\n"
+"Usage: zseb-micro [OPTIONS]\n"
+"\n"
+"    Prints CSV: kernel, unit, units per run, runs, min and median ns per\n"
+"    unit, and cycles, branch misses, cache misses and dTLB load misses\n"
+"    per unit when perf_event_open is permitted (empty otherwise). The\n"
+"    LZ77 kernels run on regular pages and again on huge pages.\n"
+"\n"
+"    ARGUMENTS\n"
+"        -i, --input=file\n"
+"                Source of the LZ77 window (default = calgary/book1).\n"
+"\n"
+"        -n, --repeats=num\n"
+"                Timed runs per kernel (default = 20).\n"
+"\n"
+"        -h, --help\n"
+"                Display this help.\n"
+"\n"
+" " << std::endl;
+}
+
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::string infile = "calgary/book1";
+    uint32_t repeats = 20;
+
+    struct option long_options[] =
+    {
+        {"input",   required_argument, 0, 'i'},
+        {"repeats", required_argument, 0, 'n'},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "hi:n:", long_options, &option_index)) != -1)
+    {
+        switch(c)
+        {
+            case 'h':
+            case '?':
+                print_help();
+                return 0;
+            case 'i':
+                infile = optarg;
+                break;
+            case 'n':
+                repeats = atoi(optarg);
+                break;
+        }
+    }
+    if (repeats == 0)
+    {
+        std::cerr << "zseb-micro: option -n must be positive" << std::endl;
+        return 255;
+    }
+
+    // Fixed window: HIST_SIZE bytes of history and WINDOW bytes to deflate, repeated if the input is short
+    std::ifstream file(infile.c_str(), std::ios::in|std::ios::binary);
+    std::vector<char> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (input.empty())
+    {
+        std::cerr << "zseb-micro: Unable to read " << infile << "." << std::endl;
+        return 255;
+    }
+    const uint32_t end = zseb::lz77::HIST_SIZE + WINDOW;
+    std::vector<char> window(end + zseb::FRAME_EXTRA, 0);
+    for (uint32_t idx = 0; idx < end; ++idx){ window[idx] = input[idx % input.size()]; }
+
+    counters perf;
+    std::cout << "kernel,unit,units,runs,ns_min,ns_p50,cycles,branch_misses,cache_misses,dtlb_misses" << std::endl;
+
+    /***  LZ77  ***/
+
+    std::vector<uint32_t> store(WINDOW);
+    std::vector<zseb::lz77::segment> segments;
+    zseb::lz77::tokens output = { store.data(), 0, &segments };
+
+    // Hash chains on regular pages, then on huge pages (see pages.hpp): the dTLB misses of the random walks
+    for (const bool huge : { false, true })
+    {
+        zseb::pages::global().huge = huge;
+        zseb::pages::unique<zseb::lz77::chains> chains = zseb::pages::make<zseb::lz77::chains>();
+        zseb::lz77::chains& table = *chains;
+        const std::string kind = huge ? " (huge pages)" : "";
+        measure(perf, "lz77::deflate" + kind, "byte", WINDOW, repeats, [&]()
+        {
+            output.size = 0;
+            segments.clear();
+            sink = zseb::lz77::deflate(window.data(), zseb::lz77::HIST_SIZE, end, table, output);
+        });
+
+        // Re-hashing the history: the part of each batch which the compressor skips when it carries the chains over
+        measure(perf, "lz77::prepare" + kind, "byte", zseb::lz77::HIST_SIZE, repeats, [&]()
+        {
+            sink = zseb::lz77::prepare(window.data(), zseb::lz77::HIST_SIZE, end, table);
+        });
+
+        // Chains of the first HIST_SIZE positions, as deflate leaves them just before each match call
+        {
+            table.clear();
+            uint32_t key = zseb::lz77::update(zseb::lz77::update(zseb::lz77::update(0, window[0]), window[1]), window[2]);
+            for (uint32_t pos = 0; pos < zseb::lz77::HIST_SIZE; ++pos)
+            {
+                table.prev[pos] = table.head[key];
+                table.head[key] = pos;
+                key = zseb::lz77::update(key, window[pos + 3]);
+            }
+        }
+        measure(perf, "lz77::match" + kind, "position", zseb::lz77::HIST_SIZE, repeats, [&]()
+        {
+            uint64_t total = 0;
+            for (uint32_t pos = 0; pos < zseb::lz77::HIST_SIZE; ++pos)
+                total += zseb::lz77::match(window.data(), pos, end - pos, table.prev, 0).second;
+            sink = total;
+        });
+    }
+
+    /***  HUFFMAN  ***/
+
+    // One block of the deflated window, as the compressor hands it to huffman
+    zseb::lz77::chains table;
+    output.size = 0;
+    segments.clear();
+    zseb::lz77::deflate(window.data(), zseb::lz77::HIST_SIZE, end, table, output);
+    uint16_t histogram[ZSEB_HUF_COMBI] = {};
+    uint32_t num_tokens = 0;
+    for (const zseb::lz77::segment& item : segments)
+    {
+        if (num_tokens + item.size > zseb::ZSEB_BLOCK_SIZE){ break; }
+        for (uint32_t sym = 0; sym < ZSEB_HUF_COMBI; ++sym){ histogram[sym] += item.stat[sym]; }
+        num_tokens += item.size;
+    }
+
+    zseb::huffman coder;
+    measure(perf, "huffman::calc_tree", "symbol", ZSEB_HUF_COMBI, repeats, [&](){ coder.calc_tree(histogram); sink = coder.get_size_X2(); });
+
+    uint16_t stat[ZSEB_HUF_LLEN];
+    zseb::zseb_node tree[ZSEB_HUF_TREE_LLEN];
+    bool temp[ZSEB_HUF_TREE_LLEN];
+    measure(perf, "huffman::__prefix_lengths__", "symbol", ZSEB_HUF_LLEN, repeats, [&]()
+    {
+        std::copy(histogram, histogram + ZSEB_HUF_LLEN, stat);
+        stat[ZSEB_LITLEN] = 1;
+        sink = zseb::huffman_kernels::prefix_lengths(stat, ZSEB_HUF_LLEN, tree, temp);
+    });
+    const std::vector<uint16_t> lengths(stat, stat + ZSEB_HUF_LLEN);
+    measure(perf, "huffman::__build_tree__(O)", "symbol", ZSEB_HUF_LLEN, repeats, [&]()
+    {
+        std::copy(lengths.begin(), lengths.end(), stat);
+        zseb::huffman_kernels::build_tree(stat, ZSEB_HUF_LLEN, tree, temp, 'O');
+        sink = tree[0].data;
+    });
+    measure(perf, "huffman::__build_tree__(I)", "symbol", ZSEB_HUF_LLEN, repeats, [&]()
+    {
+        std::copy(lengths.begin(), lengths.end(), stat);
+        zseb::huffman_kernels::build_tree(stat, ZSEB_HUF_LLEN, tree, temp, 'I');
+        sink = tree[0].child[0];
+    });
+
+    std::vector<char> packed;
+    packed.reserve(4 * num_tokens + 1024);
+    coder.calc_tree(histogram);
+    measure(perf, "huffman::pack", "symbol", num_tokens, repeats, [&]()
+    {
+        packed.clear();
+        zseb::stream::outbuf buffer(packed);
+        std::ostream stream(&buffer);
+        zseb::obstream zipfile(stream);
+        zipfile.write(2, 2);
+        coder.write_tree(zipfile);
+        coder.pack(zipfile, store.data(), num_tokens);
+        coder.stop(zipfile);
+        zipfile.flush();
+    });
+
+    zseb::huffman decoder;
+    std::vector<uint8_t>  llen_pack;
+    std::vector<uint16_t> dist_pack;
+    llen_pack.reserve(num_tokens + 1);
+    dist_pack.reserve(num_tokens + 1);
+    measure(perf, "huffman::load_tree+unpack", "symbol", num_tokens, repeats, [&]()
+    {
+        zseb::stream::inbuf buffer(packed.data(), packed.size());
+        std::istream stream(&buffer);
+        zseb::ibstream zipfile(stream);
+        zipfile.read(2);
+        llen_pack.clear();
+        dist_pack.clear();
+        sink = static_cast<uint64_t>(decoder.load_tree(zipfile));
+        sink = decoder.unpack(zipfile, llen_pack, dist_pack);
+    });
+    if (llen_pack.size() != num_tokens)
+    {
+        std::cerr << "zseb-micro: huffman::unpack returned " << llen_pack.size() << " instead of " << num_tokens << " tokens." << std::endl;
+        return 255;
+    }
+
+    /***  BIT I/O  ***/
+
+    std::mt19937 generator(1);
+    std::vector<std::pair<uint32_t, uint16_t>> pairs(NUM_BITS);
+    uint64_t total_bits = 0;
+    for (std::pair<uint32_t, uint16_t>& item : pairs)
+    {
+        item.second = static_cast<uint16_t>(1 + generator() % 15);
+        item.first  = generator() & ((1U << item.second) - 1);
+        total_bits += item.second;
+    }
+    std::vector<char> bits;
+    bits.reserve(total_bits / CHAR_BIT + 8);
+    measure(perf, "obstream::write", "symbol", NUM_BITS, repeats, [&]()
+    {
+        bits.clear();
+        zseb::stream::outbuf buffer(bits);
+        std::ostream stream(&buffer);
+        zseb::obstream zipfile(stream);
+        for (const std::pair<uint32_t, uint16_t>& item : pairs){ zipfile.write(item.first, item.second); }
+        zipfile.flush();
+    });
+    measure(perf, "ibstream::read", "symbol", NUM_BITS, repeats, [&]()
+    {
+        zseb::stream::inbuf buffer(bits.data(), bits.size());
+        std::istream stream(&buffer);
+        zseb::ibstream zipfile(stream);
+        uint64_t total = 0;
+        for (const std::pair<uint32_t, uint16_t>& item : pairs){ total += zipfile.read(item.second); }
+        sink = total;
+    });
+
+    /***  CHECKSUMS  ***/
+
+    std::vector<char> data(CRC_SIZE);
+    for (char& byte : data){ byte = static_cast<char>(generator() & UINT8_MAX); }
+    measure(perf, "crc32::update", "byte", CRC_SIZE, repeats, [&](){ sink = zseb::crc32::update(0, data.data(), CRC_SIZE); });
+    measure(perf, "adler32::update", "byte", CRC_SIZE, repeats, [&](){ sink = zseb::adler32::update(1, data.data(), CRC_SIZE); });
+
+    if (!perf.available())
+        std::cerr << "zseb-micro: perf_event_open is not permitted; hardware counters are left empty." << std::endl;
+    return 0;
+}
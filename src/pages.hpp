@@ -0,0 +1,113 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// Anonymous memory of zip (the frame and the hash chains, which lz77::match walks at random) on 2 MiB pages, so that
+// one TLB entry covers what takes 512 with 4 KiB pages: hugetlbfs pages if the administrator reserved them
+// (vm.nr_hugepages), else transparent huge pages requested with madvise(MADV_HUGEPAGE), else regular pages.
+
+namespace zseb
+{
+namespace pages
+{
+
+
+constexpr const size_t HUGE_SIZE = 2UL << 20;
+constexpr const size_t HUGE_MIN  = 256UL << 10; // Smaller allocations stay on regular pages: rounding up to 2 MiB costs more than it saves
+
+struct settings
+{
+    bool huge; // zseb-bench and zseb-micro compare with regular pages
+};
+
+inline settings& global()
+{
+    static settings item{ true };
+    return item;
+}
+
+// Zero, untouched pages for size bytes, or nullptr; mapped receives the length for release
+inline void * allocate(const size_t size, size_t& mapped)
+{
+    if (global().huge && (size >= HUGE_MIN))
+    {
+        mapped = (size + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1);
+        void * data = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED)
+            return data;
+
+        // One huge page extra, so that the start can be aligned; the advice applies before the first touch
+        char * raw = static_cast<char *>(mmap(nullptr, mapped + HUGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (raw != MAP_FAILED)
+        {
+            char * aligned = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(raw) + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1));
+            if (aligned != raw){ munmap(raw, aligned - raw); }
+            munmap(aligned + mapped, raw + HUGE_SIZE - aligned);
+            madvise(aligned, mapped, MADV_HUGEPAGE); // EINVAL without THP: regular pages
+            return aligned;
+        }
+    }
+    mapped = size;
+    void * data = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return data == MAP_FAILED ? nullptr : data;
+}
+
+inline void release(void * data, const size_t mapped)
+{
+    if (data != nullptr){ munmap(data, mapped); }
+}
+
+struct deleter
+{
+    size_t mapped;
+
+    void operator()(void * data) const{ release(data, mapped); }
+};
+
+template <typename T>
+using unique = std::unique_ptr<T, deleter>;
+
+// T constructed in pages of its own
+template <typename T>
+unique<T> make()
+{
+    static_assert(std::is_trivially_destructible<T>::value, "release only unmaps");
+    size_t mapped = 0;
+    void * data = allocate(sizeof(T), mapped);
+    if (data == nullptr)
+    {
+        std::cerr << "zseb: Unable to allocate " << sizeof(T) << " bytes." << std::endl;
+        exit(255);
+    }
+    return unique<T>(new (data) T(), deleter{ mapped });
+}
+
+
+} // End of namespace pages
+} // End of namespace zseb
@@ -0,0 +1,537 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <utility>
+
+// File I/O of zip and unzip with io_uring (zseb --uring), on the raw system calls: DEPTH registered buffers of CHUNK
+// bytes, so that the reads ahead of LZ77 and the writes behind the Huffman stage overlap with compression. Without
+// io_uring (old kernel, seccomp), the same buffers are read and written with blocking pread and pwrite; a queue also
+// switches to them when io_uring fails on the first requests.
+
+namespace zseb
+{
+namespace ring
+{
+
+
+constexpr const uint32_t DEPTH = 4;       // Requests in flight
+constexpr const uint32_t CHUNK = 1 << 20; // Bytes per request
+
+struct settings
+{
+    bool active;
+};
+
+inline settings& global()
+{
+    static settings item{ false };
+    return item;
+}
+
+inline void enable()
+{
+    global().active = true;
+}
+
+
+// Submission and completion rings with one request per buffer; user_data is the buffer index
+class queue
+{
+    public:
+
+        queue() : ring(-1), fixed(false), proven(false), inflight(0), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED), sqes(MAP_FAILED)
+        {
+            void * pages = mmap(nullptr, DEPTH * CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (pages == MAP_FAILED)
+            {
+                std::cerr << "zseb: Unable to allocate the I/O buffers." << std::endl;
+                exit(255);
+            }
+            store = static_cast<char *>(pages);
+            setup();
+        }
+
+        ~queue()
+        {
+            release();
+            munmap(store, DEPTH * CHUNK);
+        }
+
+        queue(const queue&) = delete;
+        queue& operator=(const queue&) = delete;
+
+        char * buffer(const uint32_t index) const{ return store + static_cast<size_t>(index) * CHUNK; }
+
+        bool uring() const{ return ring >= 0; }
+
+        // Read or write size bytes of buffer index at offset of fd
+        void submit(const bool write, const int fd, const uint32_t index, const uint32_t size, const uint64_t offset)
+        {
+            requests[index] = { write, fd, size, offset };
+            if (ring < 0)
+            {
+                done.emplace_back(index, blocking(index));
+                return;
+            }
+            const uint32_t tail  = *sq_tail;
+            const uint32_t entry = tail & *sq_mask;
+            io_uring_sqe& sqe = static_cast<io_uring_sqe *>(sqes)[entry];
+            memset(&sqe, 0, sizeof(sqe));
+            vectors[index].iov_len = size;
+            if (fixed)
+            {
+                sqe.opcode    = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+                sqe.addr      = reinterpret_cast<uint64_t>(buffer(index));
+                sqe.len       = size;
+                sqe.buf_index = static_cast<uint16_t>(index);
+            }
+            else
+            {
+                sqe.opcode    = write ? IORING_OP_WRITEV : IORING_OP_READV; // Since 5.1, unlike IORING_OP_READ and WRITE
+                sqe.addr      = reinterpret_cast<uint64_t>(&vectors[index]);
+                sqe.len       = 1;
+            }
+            sqe.fd        = fd;
+            sqe.off       = offset;
+            sqe.user_data = index;
+            sq_array[entry] = entry;
+            __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+            long submitted = 0;
+            while (((submitted = syscall(__NR_io_uring_enter, ring, 1, 0, 0, nullptr, 0)) < 0) && (errno == EINTR)){}
+            if (submitted == 1)
+            {
+                ++inflight;
+                return;
+            }
+            // Not submitted: the request would never complete, so it and all later ones use pread and pwrite
+            downgrade();
+            done.emplace_back(index, blocking(index));
+        }
+
+        // Next completion: buffer index and bytes transferred, or -errno
+        std::pair<uint32_t, int32_t> wait()
+        {
+            if (ring < 0)
+            {
+                const std::pair<uint32_t, int32_t> item = done.front();
+                done.pop_front();
+                return item;
+            }
+            const std::pair<uint32_t, int32_t> item = reap();
+            if ((!proven) && (unsupported(item.second)))
+            {
+                // The kernel lacks the opcode: retry it, and the requests still in flight, with pread and pwrite
+                downgrade();
+                done.emplace_front(item.first, blocking(item.first));
+                return wait();
+            }
+            proven = proven || (item.second >= 0);
+            return item;
+        }
+
+    private:
+
+        int ring;
+
+        bool fixed; // Buffers registered: *_FIXED requests skip mapping the pages per request
+
+        bool proven; // A request succeeded, so io_uring supports its opcodes
+
+        uint32_t inflight; // Submitted requests without completion
+
+        struct request
+        {
+            bool     write;
+            int      fd;
+            uint32_t size;
+            uint64_t offset;
+        };
+
+        std::array<request, DEPTH> requests; // Last request per buffer, for the pread and pwrite retry
+
+        std::array<iovec, DEPTH> vectors; // Buffers, for registration or IORING_OP_READV and WRITEV
+
+        char * store;
+
+        io_uring_params params;
+
+        size_t sq_size;
+
+        size_t cq_size;
+
+        void * sq_ptr;
+
+        void * cq_ptr;
+
+        void * sqes;
+
+        uint32_t * sq_tail;
+
+        uint32_t * sq_mask;
+
+        uint32_t * sq_array;
+
+        uint32_t * cq_head;
+
+        uint32_t * cq_tail;
+
+        uint32_t * cq_mask;
+
+        io_uring_cqe * cqes;
+
+        std::deque<std::pair<uint32_t, int32_t>> done; // Completions of pread and pwrite
+
+        static bool unsupported(const int32_t result){ return (result == -EINVAL) || (result == -EOPNOTSUPP); }
+
+        int32_t blocking(const uint32_t index)
+        {
+            const request& item = requests[index];
+            const ssize_t result = item.write ? pwrite(item.fd, buffer(index), item.size, item.offset) : pread(item.fd, buffer(index), item.size, item.offset);
+            return result < 0 ? -errno : static_cast<int32_t>(result);
+        }
+
+        // Next completion of the ring; if waiting fails, poll, as the submitted requests still complete
+        std::pair<uint32_t, int32_t> reap()
+        {
+            while (true)
+            {
+                const uint32_t head = *cq_head;
+                if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+                {
+                    const io_uring_cqe& cqe = cqes[head & *cq_mask];
+                    const std::pair<uint32_t, int32_t> item = { static_cast<uint32_t>(cqe.user_data), cqe.res };
+                    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+                    --inflight;
+                    return item;
+                }
+                if ((syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) && (errno != EINTR)){ sched_yield(); }
+            }
+        }
+
+        // Switch to pread and pwrite: the requests in flight complete first, those unsupported are retried
+        void downgrade()
+        {
+            while (inflight > 0)
+            {
+                const std::pair<uint32_t, int32_t> item = reap();
+                done.emplace_back(item.first, ((!proven) && (unsupported(item.second))) ? blocking(item.first) : item.second);
+            }
+            release();
+        }
+
+        void release()
+        {
+            if (sqes   != MAP_FAILED){ munmap(sqes, params.sq_entries * sizeof(io_uring_sqe)); }
+            if ((cq_ptr != MAP_FAILED) && (cq_ptr != sq_ptr)){ munmap(cq_ptr, cq_size); }
+            if (sq_ptr != MAP_FAILED){ munmap(sq_ptr, sq_size); }
+            sqes = sq_ptr = cq_ptr = MAP_FAILED;
+            if (ring >= 0){ close(ring); }
+            ring = -1;
+        }
+
+        void setup()
+        {
+            memset(&params, 0, sizeof(params));
+            ring = static_cast<int>(syscall(__NR_io_uring_setup, DEPTH, &params));
+            if (ring < 0)
+                return;
+
+            sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+            cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP){ sq_size = cq_size = std::max(sq_size, cq_size); }
+            sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+            cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ptr
+                   : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+            sqes   = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+            if ((sq_ptr == MAP_FAILED) || (cq_ptr == MAP_FAILED) || (sqes == MAP_FAILED))
+            {
+                release();
+                return;
+            }
+
+            char * sq = static_cast<char *>(sq_ptr);
+            char * cq = static_cast<char *>(cq_ptr);
+            sq_tail  = reinterpret_cast<uint32_t *>(sq + params.sq_off.tail);
+            sq_mask  = reinterpret_cast<uint32_t *>(sq + params.sq_off.ring_mask);
+            sq_array = reinterpret_cast<uint32_t *>(sq + params.sq_off.array);
+            cq_head  = reinterpret_cast<uint32_t *>(cq + params.cq_off.head);
+            cq_tail  = reinterpret_cast<uint32_t *>(cq + params.cq_off.tail);
+            cq_mask  = reinterpret_cast<uint32_t *>(cq + params.cq_off.ring_mask);
+            cqes     = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+            for (uint32_t index = 0; index < DEPTH; ++index){ vectors[index] = { buffer(index), CHUNK }; }
+            fixed = syscall(__NR_io_uring_register, ring, IORING_REGISTER_BUFFERS, vectors.data(), DEPTH) == 0; // Fails above RLIMIT_MEMLOCK
+        }
+};
+
+
+// Sequential input: DEPTH reads of CHUNK bytes in flight ahead of the consumer
+class reader : public std::streambuf
+{
+    public:
+
+        reader(const std::string& filename, uint64_t& size) : name(filename), next(0), current(DEPTH - 1)
+        {
+            fd = open(filename.c_str(), O_RDONLY);
+            struct stat info;
+            size = ((fd >= 0) && (fstat(fd, &info) == 0)) ? static_cast<uint64_t>(info.st_size) : 0;
+            result.fill(PENDING);
+            if (fd < 0)
+                return;
+            for (uint32_t index = 0; index < DEPTH; ++index){ request(index); }
+        }
+
+        ~reader()
+        {
+            if (fd < 0)
+                return;
+            for (uint32_t index = 0; index < DEPTH; ++index){ while (result[index] == PENDING){ collect(); } }
+            close(fd);
+        }
+
+        bool is_open() const{ return fd >= 0; }
+
+    protected:
+
+        int_type underflow() override
+        {
+            if (gptr() < egptr())
+                return traits_type::to_int_type(*gptr());
+            if (fd < 0)
+                return traits_type::eof();
+            if (eback() != nullptr){ request(current); } // Consumed: read the chunk after the last one in flight
+
+            current = (current + 1) % DEPTH;
+            while (result[current] == PENDING){ collect(); }
+            int64_t size = result[current];
+            if (size < 0)
+            {
+                std::cerr << "zseb: Unable to read " << name << ": " << strerror(static_cast<int>(-size)) << "." << std::endl;
+                exit(255);
+            }
+            // A short read before the end of the file: fill up the chunk, as the next ones were requested at full offsets
+            while ((size > 0) && (size < CHUNK))
+            {
+                const ssize_t extra = pread(fd, ring.buffer(current) + size, CHUNK - size, offset[current] + size);
+                if (extra <= 0)
+                    break;
+                size += extra;
+            }
+            if (size == 0)
+                return traits_type::eof();
+            setg(ring.buffer(current), ring.buffer(current), ring.buffer(current) + size);
+            return traits_type::to_int_type(*gptr());
+        }
+
+    private:
+
+        static constexpr const int64_t PENDING = INT64_MIN;
+
+        const std::string name;
+
+        int fd;
+
+        uint64_t next; // File offset of the next request
+
+        uint32_t current; // Buffer of the get area
+
+        queue ring;
+
+        std::array<int64_t, DEPTH>  result; // Bytes read per buffer, or PENDING
+
+        std::array<uint64_t, DEPTH> offset;
+
+        void request(const uint32_t index)
+        {
+            result[index] = PENDING;
+            offset[index] = next;
+            ring.submit(false, fd, index, CHUNK, next);
+            next += CHUNK;
+        }
+
+        void collect()
+        {
+            const std::pair<uint32_t, int32_t> item = ring.wait();
+            result[item.first] = item.second;
+        }
+};
+
+
+// Sequential output: a full buffer is written while the next one fills, with up to DEPTH writes in flight
+class writer : public std::streambuf
+{
+    public:
+
+        writer(const std::string& filename) : name(filename), next(0), current(0)
+        {
+            fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            busy.fill(false);
+            setp(ring.buffer(current), ring.buffer(current) + CHUNK);
+        }
+
+        ~writer()
+        {
+            sync();
+            if (fd >= 0){ close(fd); }
+        }
+
+        bool is_open() const{ return fd >= 0; }
+
+    protected:
+
+        int_type overflow(int_type value) override
+        {
+            issue();
+            if (value != traits_type::eof())
+            {
+                *pptr() = traits_type::to_char_type(value);
+                pbump(1);
+            }
+            return traits_type::not_eof(value);
+        }
+
+        // Write the buffered bytes and wait for all writes
+        int sync() override
+        {
+            if (pptr() != pbase()){ issue(); }
+            for (uint32_t index = 0; index < DEPTH; ++index){ while (busy[index]){ collect(); } }
+            return 0;
+        }
+
+        pos_type seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode) override
+        {
+            return ((offset == 0) && (dir == std::ios_base::cur)) ? pos_type(next + (pptr() - pbase())) : pos_type(off_type(-1)); // Only for tellp
+        }
+
+    private:
+
+        const std::string name;
+
+        int fd;
+
+        uint64_t next; // File offset of the put area
+
+        uint32_t current; // Buffer of the put area
+
+        queue ring;
+
+        std::array<bool, DEPTH>     busy;
+
+        std::array<uint64_t, DEPTH> offset;
+
+        std::array<uint32_t, DEPTH> length;
+
+        // Submit the put area and move it to the next buffer, once that one is written
+        void issue()
+        {
+            const uint32_t size = static_cast<uint32_t>(pptr() - pbase());
+            if ((size != 0) && (fd >= 0))
+            {
+                busy[current]   = true;
+                offset[current] = next;
+                length[current] = size;
+                ring.submit(true, fd, current, size, next);
+            }
+            next += size;
+            current = (current + 1) % DEPTH;
+            while (busy[current]){ collect(); }
+            setp(ring.buffer(current), ring.buffer(current) + CHUNK);
+        }
+
+        void collect()
+        {
+            const std::pair<uint32_t, int32_t> item = ring.wait();
+            const uint32_t index = item.first;
+            if (item.second < 0)
+            {
+                std::cerr << "zseb: Unable to write " << name << ": " << strerror(-item.second) << "." << std::endl;
+                exit(255);
+            }
+            // A short write: the rest with pwrite
+            uint32_t written = static_cast<uint32_t>(item.second);
+            while (written < length[index])
+            {
+                const ssize_t extra = pwrite(fd, ring.buffer(index) + written, length[index] - written, offset[index] + written);
+                if (extra <= 0)
+                {
+                    std::cerr << "zseb: Unable to write " << name << "." << std::endl;
+                    exit(255);
+                }
+                written += static_cast<uint32_t>(extra);
+            }
+            busy[index] = false;
+        }
+};
+
+
+// Input of zip: a reader after enable(), else a std::filebuf; nullptr if filename cannot be opened
+inline std::unique_ptr<std::streambuf> input(const std::string& filename, uint64_t& size)
+{
+    if (global().active)
+    {
+        std::unique_ptr<reader> item(new reader(filename, size));
+        return item->is_open() ? std::move(item) : nullptr;
+    }
+    std::unique_ptr<std::filebuf> item(new std::filebuf());
+    if (item->open(filename.c_str(), std::ios::in|std::ios::binary) == nullptr)
+        return nullptr;
+    size = static_cast<uint64_t>(item->pubseekoff(0, std::ios::end, std::ios::in));
+    item->pubseekpos(0, std::ios::in);
+    return std::move(item);
+}
+
+// Output of zip and unzip: a writer after enable(), else a std::filebuf; nullptr if filename cannot be created
+inline std::unique_ptr<std::streambuf> output(const std::string& filename)
+{
+    if (global().active)
+    {
+        std::unique_ptr<writer> item(new writer(filename));
+        return item->is_open() ? std::move(item) : nullptr;
+    }
+    std::unique_ptr<std::filebuf> item(new std::filebuf());
+    if (item->open(filename.c_str(), std::ios::out|std::ios::binary|std::ios::trunc) == nullptr)
+        return nullptr;
+    return std::move(item);
+}
+
+
+} // End of namespace ring
+} // End of namespace zseb
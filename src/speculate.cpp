@@ -0,0 +1,386 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+    Speculative parallel inflation, in the spirit of pugz and rapidgzip.
+
+    The compressed stream is cut in chunks of CHUNK_SIZE bytes. The first chunk starts at a known block
+    boundary. Every other chunk searches its first CHUNK_SIZE bytes for a bit position where a plausible
+    dynamic block header starts, and inflates from there without knowing the preceding 32 KiB history:
+    the frame is prefixed with MARKER + i placeholders for byte i of that unknown window. Each chunk stops
+    at the first block which starts in the next chunk. A chunk is accepted if it started exactly where the
+    accepted preceding chunk stopped; the placeholders are then replaced once the preceding window is known.
+    At the first chunk which is not accepted, the next round restarts serially from the last accepted
+    boundary, so that a wrong guess only costs time.
+*/
+
+#include <assert.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "speculate.h"
+#include "huffman.h"
+#include "bitstream.hpp"
+#include "lz77.hpp"
+
+namespace zseb
+{
+namespace speculate
+{
+
+constexpr const uint32_t CHUNK_SIZE  = 1U << 20; // Compressed bytes per chunk
+constexpr const uint32_t CHUNK_EXTRA = 1024;     // Enough to check a block header which starts near the end of a chunk
+constexpr const uint32_t MAX_TOKENS  = 1U << 20; // Longer blocks are not speculated on
+constexpr const uint32_t MAX_OUTPUT  = 1U << 26; // Per chunk; a chunk stops at the next block boundary when exceeded
+constexpr const uint16_t MARKER      = 256;      // Frame elements >= MARKER are byte (element - MARKER) of the unknown window
+
+constexpr const uint8_t map_ssq[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+
+// Canonical prefix code (paragraph 3.2.2 RFC 1951), to check candidate block headers in memory
+struct canonical
+{
+    uint16_t count[ZSEB_MAX_BITS_LLD + 1];
+    uint16_t symbol[ZSEB_HUF_LLEN];
+
+    // Returns false unless the code lengths form a complete prefix code
+    bool build(const uint8_t * lengths, const uint16_t size)
+    {
+        for (uint16_t len = 0; len <= ZSEB_MAX_BITS_LLD; ++len){ count[len] = 0; }
+        for (uint16_t sym = 0; sym < size; ++sym){ count[lengths[sym]] += 1; }
+
+        int32_t left = 1;
+        for (uint16_t len = 1; len <= ZSEB_MAX_BITS_LLD; ++len)
+        {
+            left = 2 * left - count[len];
+            if (left < 0){ return false; } // Over-subscribed
+        }
+        if (left != 0){ return false; } // Incomplete
+
+        uint16_t offset[ZSEB_MAX_BITS_LLD + 1];
+        offset[1] = 0;
+        for (uint16_t len = 1; len < ZSEB_MAX_BITS_LLD; ++len){ offset[len + 1] = offset[len] + count[len]; }
+        for (uint16_t sym = 0; sym < size; ++sym)
+        {
+            if (lengths[sym] != 0){ symbol[offset[lengths[sym]]++] = sym; }
+        }
+        return true;
+    }
+
+    template <typename Reader>
+    uint16_t decode(Reader& read) const
+    {
+        int32_t code  = 0; // Bits read so far
+        int32_t first = 0; // First code of length len
+        int32_t index = 0; // Index of first code of length len in symbol
+        for (uint16_t len = 1; len <= ZSEB_MAX_BITS_LLD; ++len)
+        {
+            code |= static_cast<int32_t>(read(1));
+            const int32_t num = count[len];
+            if (code - first < num){ return symbol[index + code - first]; }
+            index += num;
+            first  = (first + num) << 1;
+            code <<= 1;
+        }
+        return UINT16_MAX; // Unreachable for complete codes
+    }
+};
+
+
+// Strict check of a dynamic block header, after BFINAL and BTYPE: complete codes, valid repeats and a stop codon
+template <typename Reader>
+bool check_header(Reader& read)
+{
+    const uint16_t HLIT  = static_cast<uint16_t>(read(5) + 257);
+    const uint16_t HDIST = static_cast<uint16_t>(read(5) + 1);
+    const uint16_t HCLEN = static_cast<uint16_t>(read(4) + 4);
+    if ((HLIT > 286) || (HDIST > 30)){ return false; }
+
+    uint8_t lengths[ZSEB_HUF_COMBI];
+    for (uint16_t idx = 0; idx < ZSEB_HUF_SSQ; ++idx){ lengths[idx] = 0; }
+    for (uint16_t idx = 0; idx < HCLEN; ++idx){ lengths[map_ssq[idx]] = static_cast<uint8_t>(read(3)); }
+
+    canonical code;
+    if (!code.build(lengths, ZSEB_HUF_SSQ)){ return false; }
+
+    const uint16_t total = HLIT + HDIST;
+    uint16_t idx = 0;
+    while (idx < total)
+    {
+        const uint16_t sym = code.decode(read);
+        if (sym < 16){ lengths[idx++] = static_cast<uint8_t>(sym); continue; }
+
+        uint8_t  item   = 0;
+        uint16_t repeat = 0;
+        if (sym == 16)
+        {
+            if (idx == 0){ return false; }
+            item   = lengths[idx - 1];
+            repeat = static_cast<uint16_t>(3 + read(2));
+        }
+        else
+            repeat = static_cast<uint16_t>(sym == 17 ? 3 + read(3) : 11 + read(7));
+
+        if (idx + repeat > total){ return false; }
+        for (; repeat != 0; --repeat){ lengths[idx++] = item; }
+    }
+
+    if (lengths[ZSEB_LITLEN] == 0){ return false; }
+    return code.build(lengths, HLIT) && code.build(lengths + HLIT, HDIST);
+}
+
+
+// Reads bits from memory in the same order as ibstream; zero bits beyond the buffer
+struct membits
+{
+    const std::vector<char>& buffer;
+    uint64_t position;
+
+    uint32_t operator()(const uint16_t nbits)
+    {
+        uint32_t value = 0;
+        for (uint16_t bit = 0; bit < nbits; ++bit, ++position)
+        {
+            const uint64_t byte = position / CHAR_BIT;
+            if (byte < buffer.size())
+                value ^= ((static_cast<uint8_t>(buffer[byte]) >> (position % CHAR_BIT)) & 1U) << bit;
+        }
+        return value;
+    }
+};
+
+
+struct chunk
+{
+    uint64_t start;              // Bit position of the first block
+    uint64_t end;                // Bit position of the block after the last decoded one
+    bool     last;               // The final block was decoded
+    bool     valid;              // Decoding from start succeeded
+    uint64_t size_lzss;
+    std::vector<uint16_t> frame; // HIST_SIZE placeholders, followed by the output of the chunk
+    std::vector<char> window;    // Resolved HIST_SIZE bytes preceding the chunk
+    std::vector<char> output;    // Resolved output of the chunk
+};
+
+
+// Decode blocks from item.start, until a block starts at or beyond stop. Invalid block headers end decoding;
+// when strict, long blocks are rejected too, so that garbage found by speculation cannot run for long.
+void decode(ibstream& zipfile, chunk& item, const uint64_t stop, const bool strict, huffman& coder, std::vector<uint8_t>& llen_pack, std::vector<uint16_t>& dist_pack)
+{
+    item.frame.resize(lz77::HIST_SIZE);
+    for (uint32_t cnt = 0; cnt < lz77::HIST_SIZE; ++cnt){ item.frame[cnt] = MARKER + cnt; }
+    item.last      = false;
+    item.valid     = false;
+    item.size_lzss = 0;
+    zipfile.seek_bit(item.start);
+
+    while (true)
+    {
+        const uint64_t position = zipfile.bit_pos();
+        if (!zipfile.good()){ return; }
+        if ((position >= stop) || (item.frame.size() >= MAX_OUTPUT + lz77::HIST_SIZE))
+        {
+            item.end   = position;
+            item.valid = true;
+            return;
+        }
+
+        const uint32_t last_block = zipfile.read(1);
+        const uint32_t block_form = zipfile.read(2); // '10'_b dyn trees, '01'_b fixed trees, '00'_b uncompressed, '11'_b error
+        if (block_form == 3){ return; }
+
+        if (block_form == 0)
+        {
+            zipfile.next_byte();
+            char vals[4];
+            zipfile.read(vals, 4);
+            const uint16_t  LEN = static_cast<uint16_t>(stream::str2int(vals,     2));
+            const uint16_t NLEN = static_cast<uint16_t>(stream::str2int(vals + 2, 2));
+            if (NLEN != static_cast<uint16_t>(~LEN)){ return; }
+            std::vector<char> data(LEN);
+            if (LEN != 0){ zipfile.read(&data[0], LEN); }
+            for (const char byte : data){ item.frame.push_back(static_cast<uint8_t>(byte)); }
+        }
+        else
+        {
+            if (block_form == 2) // Dynamic trees
+            {
+                if (coder.load_tree(zipfile) != inflate_error::none){ return; }
+            }
+            else // Fixed trees
+                coder.fixed_tree('I');
+
+            const bool complete = coder.unpack(zipfile, llen_pack, dist_pack, strict ? MAX_TOKENS : SIZE_MAX);
+            if (complete)
+            {
+                for (size_t idx = 0; idx != llen_pack.size(); ++idx)
+                    item.size_lzss += lz77::inflate(item.frame, llen_pack[idx], dist_pack[idx]);
+            }
+            llen_pack.clear();
+            dist_pack.clear();
+            if (!complete){ return; }
+        }
+
+        if (last_block == 1)
+        {
+            item.end   = zipfile.bit_pos();
+            item.last  = true;
+            item.valid = zipfile.good();
+            return;
+        }
+    }
+}
+
+
+// Find the first bit position in [from, stop) from which decode succeeds
+void search(const std::string& smallfile, chunk& item, const uint64_t from, const uint64_t stop)
+{
+    std::vector<char> buffer(CHUNK_SIZE + CHUNK_EXTRA);
+    std::ifstream rawfile;
+    rawfile.open(smallfile.c_str(), std::ios::in|std::ios::binary);
+    rawfile.seekg(from / CHAR_BIT, std::ios::beg);
+    rawfile.read(&buffer[0], buffer.size());
+    buffer.resize(rawfile.gcount());
+    rawfile.close();
+
+    ibstream zipfile(smallfile);
+    huffman coder;
+    std::vector<uint8_t>  llen_pack;
+    std::vector<uint16_t> dist_pack;
+
+    for (uint64_t candidate = from; candidate < stop; ++candidate)
+    {
+        membits bits = { buffer, candidate - CHAR_BIT * (from / CHAR_BIT) };
+        if ((bits(1) != 0) || (bits(2) != 2) || (!check_header(bits))) // Non-final dynamic block
+            continue;
+
+        item.start = candidate;
+        decode(zipfile, item, stop, true, coder, llen_pack, dist_pack);
+        if (item.valid)
+            return;
+    }
+    item.valid = false;
+}
+
+
+// Replace the placeholders of the unknown window
+inline char resolve(const uint16_t element, const std::vector<char>& window) noexcept
+{
+    return element < MARKER ? static_cast<char>(element) : window[element - MARKER];
+}
+
+
+uint64_t inflate(const std::string& smallfile, const uint64_t start, const uint32_t num_threads, const std::vector<char>& history,
+    const std::function<void(const char *, const uint32_t)>& output, uint64_t& size_lzss)
+{
+    std::ifstream rawfile;
+    rawfile.open(smallfile.c_str(), std::ios::in|std::ios::binary|std::ios::ate);
+    const uint64_t size_bits = CHAR_BIT * static_cast<uint64_t>(rawfile.tellg());
+    rawfile.close();
+
+    std::vector<chunk> chunks(num_threads);
+    std::vector<char> window(lz77::HIST_SIZE - history.size(), 0); // Zeros preceding the start of the stream are never referenced
+    window.insert(window.end(), history.begin(), history.end());
+    std::vector<std::thread> threads; threads.reserve(num_threads);
+    uint64_t position = start;
+
+    while (true)
+    {
+        uint32_t num_chunks = 1;
+        while ((num_chunks < num_threads) && (position + CHAR_BIT * static_cast<uint64_t>(CHUNK_SIZE) * num_chunks < size_bits))
+            ++num_chunks;
+
+        for (uint32_t threadID = 0; threadID < num_chunks; ++threadID)
+        {
+            threads.emplace_back([threadID, position, &smallfile, &chunks](){
+                const uint64_t from = position + CHAR_BIT * static_cast<uint64_t>(CHUNK_SIZE) * threadID;
+                const uint64_t stop = from + CHAR_BIT * static_cast<uint64_t>(CHUNK_SIZE);
+                if (threadID == 0) // Known block boundary
+                {
+                    ibstream zipfile(smallfile);
+                    huffman coder;
+                    std::vector<uint8_t>  llen_pack;
+                    std::vector<uint16_t> dist_pack;
+                    chunks[0].start = from;
+                    decode(zipfile, chunks[0], stop, false, coder, llen_pack, dist_pack);
+                }
+                else
+                    search(smallfile, chunks[threadID], from, stop);
+            });
+        }
+        for (std::thread& t : threads)
+            t.join();
+        threads.clear();
+
+        if (!chunks[0].valid)
+        {
+            std::cerr << "zseb: Invalid DEFLATE stream." << std::endl;
+            exit(255);
+        }
+
+        uint32_t accepted = 1;
+        while ((accepted < num_chunks) && (!chunks[accepted - 1].last) && (chunks[accepted].valid) && (chunks[accepted].start == chunks[accepted - 1].end))
+            ++accepted;
+
+        // Propagate the windows serially: last HIST_SIZE bytes of the preceding window and output
+        for (uint32_t idx = 0; idx < accepted; ++idx)
+        {
+            chunk& item = chunks[idx];
+            item.window = window;
+            const size_t produced = item.frame.size() - lz77::HIST_SIZE;
+            const size_t keep     = produced >= lz77::HIST_SIZE ? 0 : lz77::HIST_SIZE - produced;
+            std::vector<char> next(window.end() - keep, window.end());
+            for (size_t cnt = item.frame.size() - (lz77::HIST_SIZE - keep); cnt < item.frame.size(); ++cnt)
+                next.push_back(resolve(item.frame[cnt], item.window));
+            window.swap(next);
+        }
+
+        // Resolve the placeholders concurrently
+        for (uint32_t threadID = 0; threadID < accepted; ++threadID)
+        {
+            threads.emplace_back([threadID, &chunks](){
+                chunk& item = chunks[threadID];
+                item.output.resize(item.frame.size() - lz77::HIST_SIZE);
+                for (size_t cnt = 0; cnt < item.output.size(); ++cnt)
+                    item.output[cnt] = resolve(item.frame[lz77::HIST_SIZE + cnt], item.window);
+            });
+        }
+        for (std::thread& t : threads)
+            t.join();
+        threads.clear();
+
+        for (uint32_t idx = 0; idx < accepted; ++idx)
+        {
+            if (chunks[idx].output.size() != 0){ output(&chunks[idx].output[0], chunks[idx].output.size()); }
+            size_lzss += chunks[idx].size_lzss;
+        }
+
+        position = chunks[accepted - 1].end;
+        if (chunks[accepted - 1].last)
+            return position;
+    }
+}
+
+
+} // End of namespace speculate
+} // End of namespace zseb
+
@@ -0,0 +1,41 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <functional>
+#include <vector>
+
+
+namespace zseb
+{
+namespace speculate
+{
+
+// Experimental: inflate the DEFLATE stream of smallfile starting at bit position start on num_threads threads.
+// output receives the uncompressed bytes in order; returns the bit position after the final block.
+// history holds the bytes (at most 32 KiB) preceding the stream, e.g. a preset dictionary.
+uint64_t inflate(const std::string& smallfile, const uint64_t start, const uint32_t num_threads, const std::vector<char>& history,
+    const std::function<void(const char *, const uint32_t)>& output, uint64_t& size_lzss);
+
+}
+}
+
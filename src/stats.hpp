@@ -0,0 +1,193 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+#include "trace.hpp"
+
+// Instrumentation for zip and unzip. Without -DZSEB_STATS the macros expand to nothing, so that release builds carry
+// no counters, timers or clock reads. Timers add nanoseconds per stage; counters accumulate per thread and are merged
+// by ZSEB_STATS_FLUSH() when a worker finishes, so that the hot loops of lz77 touch no shared cache lines.
+// When tracing is active, every timed interval is also recorded as a trace event (see trace.hpp).
+
+namespace zseb
+{
+namespace stats
+{
+
+
+enum timer : uint32_t
+{
+    io_read,      // Reading the file to zip
+    io_write,     // Writing unzipped output
+    checksum,     // CRC32 or Adler-32
+    lz77_round,   // Wall time of the LZ77 rounds of zip, spawn to join
+    lz77_batch,   // One worker deflating its BATCH_SIZE slice; summed over the workers
+    join,         // Main thread waiting for the LZ77 workers
+    tree_build,   // Histogram, Huffman trees and block header of zip
+    pack,         // Huffman coding of the tokens of zip
+    tree_load,    // Block headers of unzip
+    unpack,       // Huffman decoding of unzip
+    expand,       // LZ77 expansion of unzip
+    NUM_TIMERS
+};
+
+enum counter : uint32_t
+{
+    match_calls,    // lz77::match
+    chain_steps,    // Hash chain entries visited by lz77::match
+    matches,        // (length, distance) tokens
+    literals,       // Literal tokens
+    lz77_carried,   // LZ77 batches which resumed the hash chains of the batch before, without lz77::prepare
+    blocks_stored,
+    blocks_fixed,
+    blocks_dynamic,
+    blocks_reused,  // Blocks of ZSEB_BLOCK_SIZE tokens appended to the open block, with its trees
+    block_tokens,   // Tokens in Huffman blocks, including the stop codons
+    block_bytes,    // Compressed bytes of the blocks of zip
+    NUM_COUNTERS
+};
+
+constexpr const uint32_t MAX_WORKERS = 64; // Per worker busy time of LZ77; higher thread IDs share the last slot
+
+constexpr const char * timer_names[NUM_TIMERS] = { "io_read", "io_write", "checksum", "lz77_round", "lz77_batch", "join",
+    "tree_build", "pack", "tree_load", "unpack", "expand" };
+
+constexpr const char * counter_names[NUM_COUNTERS] = { "match_calls", "chain_steps", "matches", "literals",
+    "lz77_carried", "blocks_stored", "blocks_fixed", "blocks_dynamic", "blocks_reused", "block_tokens", "block_bytes" };
+
+
+struct registry
+{
+    std::atomic<uint64_t> nanos[NUM_TIMERS];
+    std::atomic<uint64_t> counts[NUM_COUNTERS];
+    std::atomic<uint64_t> worker_busy[MAX_WORKERS]; // LZ77 per worker
+    std::atomic<uint64_t> worker_idle[MAX_WORKERS]; // Per worker: lz77_round minus its busy time
+};
+
+inline registry& global()
+{
+    static registry item{}; // Zero-initialised
+    return item;
+}
+
+inline uint64_t * local()
+{
+    thread_local uint64_t counts[NUM_COUNTERS] = {};
+    return counts;
+}
+
+inline uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Merge the counters of this thread into the registry
+inline void flush()
+{
+    uint64_t * counts = local();
+    for (uint32_t idx = 0; idx < NUM_COUNTERS; ++idx)
+    {
+        global().counts[idx] += counts[idx];
+        counts[idx] = 0;
+    }
+}
+
+inline void record(const timer name, const uint64_t start, const uint64_t end)
+{
+    global().nanos[name] += end - start;
+    if (trace::active()){ trace::push(name, start, end); }
+}
+
+inline void worker(const uint32_t threadID, const uint64_t busy, const uint64_t round)
+{
+    const uint32_t slot = threadID < MAX_WORKERS ? threadID : MAX_WORKERS - 1;
+    global().worker_busy[slot] += busy;
+    global().worker_idle[slot] += round > busy ? round - busy : 0;
+}
+
+// Adds the lifetime of the object to a timer
+class scope
+{
+    public:
+
+        scope(const timer name) : name(name), start(now()) {}
+
+        ~scope(){ record(name, start, now()); }
+
+    private:
+
+        const timer name;
+
+        const uint64_t start;
+};
+
+// JSON report of the registry; derived figures are averages over all calls
+inline void report(std::ostream& output, const uint32_t num_workers)
+{
+    flush();
+    const registry& item = global();
+    output << "{\n  \"seconds\": {";
+    for (uint32_t idx = 0; idx < NUM_TIMERS; ++idx)
+        output << (idx == 0 ? "" : ",") << "\n    \"" << timer_names[idx] << "\": " << 1e-9 * item.nanos[idx];
+    output << "\n  },\n  \"counts\": {";
+    for (uint32_t idx = 0; idx < NUM_COUNTERS; ++idx)
+        output << (idx == 0 ? "" : ",") << "\n    \"" << counter_names[idx] << "\": " << item.counts[idx];
+
+    const uint64_t calls  = item.counts[match_calls];
+    const uint64_t blocks = item.counts[blocks_stored] + item.counts[blocks_fixed] + item.counts[blocks_dynamic];
+    output << "\n  },\n  \"average_chain_depth\": " << (calls == 0 ? 0.0 : static_cast<double>(item.counts[chain_steps]) / calls);
+    output << ",\n  \"tokens_per_block\": " << (blocks == 0 ? 0.0 : static_cast<double>(item.counts[block_tokens]) / blocks);
+    output << ",\n  \"bytes_per_block\": " << (blocks == 0 ? 0.0 : static_cast<double>(item.counts[block_bytes]) / blocks);
+
+    const uint32_t shown = num_workers < MAX_WORKERS ? num_workers : MAX_WORKERS;
+    output << ",\n  \"workers\": [";
+    for (uint32_t idx = 0; idx < shown; ++idx)
+    {
+        output << (idx == 0 ? "" : ",") << "\n    {\"lz77\": " << 1e-9 * item.worker_busy[idx] << ", \"idle\": " << 1e-9 * item.worker_idle[idx] << "}";
+    }
+    output << "\n  ]\n}" << std::endl;
+}
+
+
+} // End of namespace stats
+} // End of namespace zseb
+
+
+#ifdef ZSEB_STATS
+    #define ZSEB_STATS_ENABLED        true
+    #define ZSEB_TIME(name)           zseb::stats::scope zseb_stats_##name(zseb::stats::name)
+    #define ZSEB_COUNT(name, value)   (zseb::stats::local()[zseb::stats::name] += (value))
+    #define ZSEB_STATS_FLUSH()        zseb::stats::flush()
+    #define ZSEB_STATS_NOW()          zseb::stats::now()
+    #define ZSEB_STATS_WORKER(threadID, busy, round) zseb::stats::worker(threadID, busy, round)
+#else
+    #define ZSEB_STATS_ENABLED        false
+    #define ZSEB_TIME(name)
+    #define ZSEB_COUNT(name, value)
+    #define ZSEB_STATS_FLUSH()
+    #define ZSEB_STATS_NOW()          0
+    #define ZSEB_STATS_WORKER(threadID, busy, round)
+#endif
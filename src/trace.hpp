@@ -0,0 +1,149 @@
+/*
+    zseb: Zipping Sequences of Encountered Bytes
+    Copyright (C) 2019, 2020 Sebastian Wouters
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Begin/end events of the instrumented stages (see stats.hpp), exported as Chrome trace-event JSON for Perfetto or
+// chrome://tracing. Every thread writes to its own ring buffer (a lane) without locks; the mutex is only taken when a
+// thread claims a lane on its first event and when it returns the lane on exit. Lanes are reused by later threads, so
+// that the short-lived LZ77 workers of successive rounds share a handful of rows in the viewer.
+
+namespace zseb
+{
+namespace trace
+{
+
+
+constexpr const uint32_t CAPACITY = 1U << 16; // Events per lane; beyond, the oldest are overwritten
+
+struct event
+{
+    uint64_t start; // Nanoseconds, steady clock
+    uint64_t end;
+    uint32_t name;  // Index into the names passed to dump
+};
+
+struct lane
+{
+    uint32_t id;
+    uint64_t written; // Events pushed in total
+    std::vector<event> ring;
+};
+
+struct registry
+{
+    std::atomic<bool> active{false};
+    std::mutex lock;
+    std::vector<std::unique_ptr<lane>> lanes;
+    std::vector<lane *> idle;
+};
+
+inline registry& global()
+{
+    static registry item;
+    return item;
+}
+
+// Claims a lane on construction and returns it when the thread exits
+class holder
+{
+    public:
+
+        holder()
+        {
+            registry& item = global();
+            std::lock_guard<std::mutex> guard(item.lock);
+            if (item.idle.empty())
+            {
+                item.lanes.emplace_back(new lane{static_cast<uint32_t>(item.lanes.size()), 0, std::vector<event>(CAPACITY)});
+                current = item.lanes.back().get();
+            }
+            else
+            {
+                current = item.idle.back();
+                item.idle.pop_back();
+            }
+        }
+
+        ~holder()
+        {
+            registry& item = global();
+            std::lock_guard<std::mutex> guard(item.lock);
+            item.idle.push_back(current);
+        }
+
+        lane * current;
+};
+
+inline bool active()
+{
+    return global().active.load(std::memory_order_relaxed);
+}
+
+inline void push(const uint32_t name, const uint64_t start, const uint64_t end)
+{
+    thread_local holder mine;
+    lane& item = *mine.current;
+    item.ring[item.written % CAPACITY] = { start, end, name };
+    ++item.written;
+}
+
+// Chrome trace-event JSON of all lanes; call once the traced threads have been joined
+inline void dump(std::ostream& output, const char * const * names)
+{
+    registry& item = global();
+    std::lock_guard<std::mutex> guard(item.lock);
+
+    uint64_t origin = UINT64_MAX;
+    for (const std::unique_ptr<lane>& row : item.lanes)
+    {
+        const uint64_t first = row->written > CAPACITY ? row->written - CAPACITY : 0;
+        for (uint64_t idx = first; idx < row->written; ++idx){ origin = std::min(origin, row->ring[idx % CAPACITY].start); }
+    }
+
+    output << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+    output << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"zseb\"}}";
+    output.setf(std::ios::fixed);
+    output.precision(3);
+    for (const std::unique_ptr<lane>& row : item.lanes)
+    {
+        output << ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << row->id
+               << ", \"args\": {\"name\": \"lane " << row->id << "\", \"dropped\": " << (row->written > CAPACITY ? row->written - CAPACITY : 0) << "}}";
+        const uint64_t first = row->written > CAPACITY ? row->written - CAPACITY : 0;
+        for (uint64_t idx = first; idx < row->written; ++idx)
+        {
+            const event& entry = row->ring[idx % CAPACITY];
+            output << ",\n  {\"name\": \"" << names[entry.name] << "\", \"cat\": \"zseb\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << row->id
+                   << ", \"ts\": " << 1e-3 * (entry.start - origin) << ", \"dur\": " << 1e-3 * (entry.end - entry.start) << "}";
+        }
+    }
+    output << "\n]}" << std::endl;
+}
+
+
+} // End of namespace trace
+} // End of namespace zseb
@@ -20,6 +20,11 @@
 #pragma once
 
 #include <string>
+#include <vector>
+
+#include "dtypes.h"
+#include "compressor.h"
+#include "decompressor.h"
 
 
 namespace zseb
@@ -27,9 +32,47 @@ namespace zseb
 namespace tools
 {
 
-void zip(const std::string& bigfile, const std::string& smallfile, const bool print, const uint32_t num_threads);
+std::vector<char> load_dictionary(const std::string& dictfile);
+
+void train(const std::string& samples, const std::string& dictfile, const uint32_t size, const bool print);
+
+// At most num_threads workers, see deflate_plan
+void zip(const std::string& bigfile, const std::string& smallfile, const bool print, const uint32_t num_threads, const zseb_format format, const std::vector<char>& dictionary = {});
+
+// In memory: append the container of data[0:size] to zipped; deflater keeps its buffers between calls.
+// With sized, the gzip header stores the member size, so that unzip inflates concatenated members concurrently.
+void zip(compressor& deflater, const char * data, const uint64_t size, std::vector<char>& zipped, const zseb_format format, const std::vector<char>& dictionary = {}, const bool sized = false);
+
+// In memory: append the contents of the first member of data[0:size] to unzipped; invalid input exits like unzip
+void unzip(decompressor& inflater, const char * data, const uint64_t size, std::vector<char>& unzipped, const zseb_format format, const std::vector<char>& dictionary = {});
+
+void unzip(const std::string& smallfile, std::string& bigfile, const bool name, const bool print, const zseb_format format, const uint32_t num_threads, const bool speculative = false, const std::vector<char>& dictionary = {});
+
+// Many files on one pool of num_threads workers with reused contexts: the regular files in the directory files, or
+// those listed (one per line) in the file files. Zip appends the suffix of the format, unzip removes it.
+void zip_batch(const std::string& files, const bool print, const uint32_t num_threads, const zseb_format format, const std::vector<char>& dictionary = {});
+
+void unzip_batch(const std::string& files, const bool print, const zseb_format format, const uint32_t num_threads, const std::vector<char>& dictionary = {});
+
+// Predicted size of the DEFLATE stream (without container) of size bytes, from a sample of the input: see estimate in zseb.cpp
+struct prediction
+{
+    uint64_t size_orig;    // Input bytes
+    uint64_t size_sampled; // Input bytes which were deflated
+    uint64_t size_zlib;    // Predicted bytes of DEFLATE blocks for the whole input
+};
+
+// Only the sampled ranges of origfile are read, with seekg
+prediction estimate(std::istream& origfile, const uint64_t size, const std::vector<char>& dictionary = {});
+
+prediction estimate(const char * data, const uint64_t size, const std::vector<char>& dictionary = {});
+
+// Dry run of zip: prints the predicted size of smallfile in the given format; nothing is written
+void estimate(const std::string& bigfile, const bool print, const zseb_format format, const std::vector<char>& dictionary = {});
+
+void index(const std::string& smallfile, const std::string& indexfile, const uint64_t span, const bool print, const zseb_format format);
 
-void unzip(const std::string& smallfile, std::string& bigfile, const bool name, const bool print);
+void extract(const std::string& smallfile, const std::string& indexfile, const std::string& bigfile, const uint64_t offset, const uint64_t length);
 
 }
 }